@@ -0,0 +1,830 @@
+#ifndef PP_BENCH_CHECK_HPP_INCLUDED
+#define PP_BENCH_CHECK_HPP_INCLUDED
+
+/**
+  @file      check.hpp
+  @copyright François Becker
+  @date      2017-2018
+  */
+
+#include "pp_curvefitter.hpp"
+#include "pp_distancetransform.hpp"
+#include "pp_gcodewriter.hpp"
+#include "pp_layermorph.hpp"
+#include "pp_lightnessimage.hpp"
+#include "pp_packedbinaryimage.hpp"
+#include "pp_skeletontracer.hpp"
+#include "pp_structuringelement.hpp"
+#include "pp_thinning.hpp"
+#include "pp_thresholdbands.hpp"
+#include "pp_tool.hpp"
+
+#include <QFile>
+#include <QImage>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ Checks that the optimized kernels give the same results as the scalar references they replace, and that the
+ essential images and the G-code of a corpus of images do not change, so that a faster rewrite of a stage can be
+ trusted not to change the prints.
+ */
+namespace Check
+{
+    /**
+     Counts the comparisons made for every kernel, and prints the first mismatches of each one with what reproduces
+     them.
+     */
+    class Checker
+    {
+    public:
+        void expect(bool pSame, const std::string& pKernel, const std::string& pCase, const std::string& pDifference = std::string())
+        {
+            Counts& lCounts = mCounts[pKernel];
+            ++lCounts.mChecks;
+            if (pSame)
+            {
+                return;
+            }
+            if (++lCounts.mMismatches <= cMaxReportedMismatches)
+            {
+                std::printf("MISMATCH %s, %s%s%s\n", pKernel.c_str(), pCase.c_str(), pDifference.empty() ? "" : ": ", pDifference.c_str());
+                std::fflush(stdout);
+            }
+        }
+
+        /**
+         Prints the number of comparisons and mismatches of every kernel. Returns false if there was a mismatch.
+         */
+        bool report() const
+        {
+            bool lSame = true;
+            std::printf("%-48s %8s %10s\n", "kernel", "checks", "mismatches");
+            for (const auto& lCounts : mCounts)
+            {
+                std::printf("%-48s %8zu %10zu\n", lCounts.first.c_str(), lCounts.second.mChecks, lCounts.second.mMismatches);
+                lSame = lSame && lCounts.second.mMismatches == 0;
+            }
+            std::fflush(stdout);
+            return lSame;
+        }
+
+    private:
+        static const size_t cMaxReportedMismatches = 5;
+
+        struct Counts
+        {
+            size_t mChecks = 0;
+            size_t mMismatches = 0;
+        };
+        std::map<std::string, Counts> mCounts;
+    };
+
+    /**
+     Empty if pActual is pExpected, otherwise where they differ.
+     */
+    static std::string getDifference(const PP::BinaryImage& pExpected, const PP::BinaryImage& pActual)
+    {
+        if (pExpected.getWidth() != pActual.getWidth() || pExpected.getHeight() != pActual.getHeight())
+        {
+            return "expected " + std::to_string(pExpected.getWidth()) + "x" + std::to_string(pExpected.getHeight())
+                    + ", got " + std::to_string(pActual.getWidth()) + "x" + std::to_string(pActual.getHeight());
+        }
+        size_t lNumDifferent = 0;
+        std::string lFirst;
+        for (size_t y = 0 ; y != pExpected.getHeight() ; ++y)
+        {
+            for (size_t x = 0 ; x != pExpected.getWidth() ; ++x)
+            {
+                if (pExpected.getPixel(x, y) != pActual.getPixel(x, y))
+                {
+                    if (lNumDifferent++ == 0)
+                    {
+                        lFirst = "at (" + std::to_string(x) + ", " + std::to_string(y) + ") expected "
+                                + std::to_string((int)pExpected.getPixel(x, y));
+                    }
+                }
+            }
+        }
+        return (lNumDifferent == 0) ? std::string() : std::to_string(lNumDifferent) + " pixels differ, first " + lFirst;
+    }
+
+    static std::string getDifference(const PP::BinaryImage& pExpected, const PP::PackedBinaryImage& pActual)
+    {
+        return getDifference(pExpected, pActual.toBinaryImage());
+    }
+
+    /**
+     Content of the random masks: noise of a random density, discs and rectangles as in the masks of the layers, all
+     pixels set, or discs and rectangles with the rows and columns at the edges of the image set.
+     */
+    enum Pattern
+    {
+        eNoise,
+        eBlobs,
+        eFull,
+        eFrame,
+        eNumPatterns
+    };
+
+    static const char* getPatternName(Pattern pPattern)
+    {
+        static const char* sNames[eNumPatterns] = {"noise", "blobs", "full", "frame"};
+        return sNames[pPattern];
+    }
+
+    static PP::BinaryImage generateMask(int pWidth, int pHeight, Pattern pPattern, std::mt19937& pRandom)
+    {
+        PP::BinaryImage lMask(pWidth, pHeight);
+        auto lUniform = [&](int pMin, int pMax) {
+            return std::uniform_int_distribution<int>(pMin, pMax)(pRandom);
+        };
+        switch (pPattern)
+        {
+            case eNoise:
+            {
+                std::bernoulli_distribution lPixel(lUniform(1, 9) / 10.);
+                for (int y = 0 ; y != pHeight ; ++y)
+                {
+                    for (int x = 0 ; x != pWidth ; ++x)
+                    {
+                        lMask.getPixel(x, y) = lPixel(pRandom);
+                    }
+                }
+                break;
+            }
+            case eBlobs:
+            case eFrame:
+            {
+                const int cNumBlobs = lUniform(1, 2 + pWidth * pHeight / 200);
+                for (int b = 0 ; b != cNumBlobs ; ++b)
+                {
+                    const int cX = lUniform(0, pWidth - 1);
+                    const int cY = lUniform(0, pHeight - 1);
+                    const int cRadius = lUniform(0, 1 + std::min(pWidth, pHeight) / 3);
+                    const bool cDisc = lUniform(0, 1) == 0;
+                    for (int y = std::max(0, cY - cRadius) ; y <= std::min(pHeight - 1, cY + cRadius) ; ++y)
+                    {
+                        for (int x = std::max(0, cX - cRadius) ; x <= std::min(pWidth - 1, cX + cRadius) ; ++x)
+                        {
+                            if (!cDisc || (x - cX) * (x - cX) + (y - cY) * (y - cY) <= cRadius * cRadius)
+                            {
+                                lMask.getPixel(x, y) = true;
+                            }
+                        }
+                    }
+                }
+                if (pPattern == eFrame)
+                {
+                    for (int x = 0 ; x != pWidth ; ++x)
+                    {
+                        lMask.getPixel(x, 0) = lMask.getPixel(x, pHeight - 1) = true;
+                    }
+                    for (int y = 0 ; y != pHeight ; ++y)
+                    {
+                        lMask.getPixel(0, y) = lMask.getPixel(pWidth - 1, y) = true;
+                    }
+                }
+                break;
+            }
+            case eFull:
+            case eNumPatterns:
+            {
+                for (int y = 0 ; y != pHeight ; ++y)
+                {
+                    for (int x = 0 ; x != pWidth ; ++x)
+                    {
+                        lMask.getPixel(x, y) = true;
+                    }
+                }
+                break;
+            }
+        }
+        return lMask;
+    }
+
+    /**
+     pIterations calls to MorphOps::thinReference, or as many as needed to reach a skeleton if negative, stopping at
+     the first one that does not change the image. Returns the number of calls that changed it.
+     */
+    static int thinReference(PP::BinaryImage& pImage, int pIterations)
+    {
+        int lIterations = 0;
+        for (int i = 0 ; pIterations < 0 || i < pIterations ; ++i)
+        {
+            const PP::BinaryImage lBefore(pImage);
+            PP::MorphOps::thinReference(pImage);
+            if (getDifference(lBefore, pImage).empty())
+            {
+                break;
+            }
+            ++lIterations;
+        }
+        return lIterations;
+    }
+
+    /**
+     Offsets of the pixels of a structuring element, from its definition.
+     */
+    static std::vector<PP::PointPixel> getElementOffsets(PP::MorphOps::StructuringElement pElement, int pRadius)
+    {
+        std::vector<PP::PointPixel> lOffsets;
+        if (pElement == PP::MorphOps::eOctagonElement)
+        {
+            // Minkowski sum of the square of radius (r + 1) / 2 and of the diamond of radius r / 2
+            const std::vector<PP::PointPixel> lSquare = getElementOffsets(PP::MorphOps::eSquareElement, (pRadius + 1) / 2);
+            const std::vector<PP::PointPixel> lDiamond = getElementOffsets(PP::MorphOps::eDiamondElement, pRadius / 2);
+            PP::BinaryImage lElement(2 * pRadius + 1, 2 * pRadius + 1);
+            for (PP::PointPixel a : lSquare)
+            {
+                for (PP::PointPixel b : lDiamond)
+                {
+                    lElement.getPixel(a.mX + b.mX + pRadius, a.mY + b.mY + pRadius) = true;
+                }
+            }
+            for (int dy = -pRadius ; dy <= pRadius ; ++dy)
+            {
+                for (int dx = -pRadius ; dx <= pRadius ; ++dx)
+                {
+                    if (lElement.getPixel(dx + pRadius, dy + pRadius))
+                    {
+                        lOffsets.push_back({dx, dy});
+                    }
+                }
+            }
+            return lOffsets;
+        }
+        for (int dy = -pRadius ; dy <= pRadius ; ++dy)
+        {
+            for (int dx = -pRadius ; dx <= pRadius ; ++dx)
+            {
+                if (pElement == PP::MorphOps::eSquareElement || std::abs(dx) + std::abs(dy) <= pRadius)
+                {
+                    lOffsets.push_back({dx, dy});
+                }
+            }
+        }
+        return lOffsets;
+    }
+
+    /**
+     Erosion or dilation by the symmetric element pOffsets, pixel by pixel, the outside of the image being background.
+     */
+    static PP::BinaryImage filterReference(const PP::BinaryImage& pImage, const std::vector<PP::PointPixel>& pOffsets, bool pDilate)
+    {
+        const int cWidth = (int)pImage.getWidth();
+        const int cHeight = (int)pImage.getHeight();
+        PP::BinaryImage lFiltered(cWidth, cHeight);
+        for (int y = 0 ; y != cHeight ; ++y)
+        {
+            for (int x = 0 ; x != cWidth ; ++x)
+            {
+                bool lAll = true;
+                bool lAny = false;
+                for (PP::PointPixel d : pOffsets)
+                {
+                    const int u = x + d.mX;
+                    const int v = y + d.mY;
+                    const bool lSet = u >= 0 && v >= 0 && u < cWidth && v < cHeight && pImage.getPixel(u, v);
+                    lAll = lAll && lSet;
+                    lAny = lAny || lSet;
+                }
+                lFiltered.getPixel(x, y) = pDilate ? lAny : lAll;
+            }
+        }
+        return lFiltered;
+    }
+
+    /**
+     Squared distance of every pixel to the closest background pixel, by comparing it to all of them, the closest
+     pixel outside of the image being straight above, below, left or right.
+     */
+    static std::vector<int> squaredDistanceTransformReference(const PP::BinaryImage& pImage)
+    {
+        const int cWidth = (int)pImage.getWidth();
+        const int cHeight = (int)pImage.getHeight();
+        std::vector<int> lDistances(cWidth * cHeight, 0);
+        for (int y = 0 ; y != cHeight ; ++y)
+        {
+            for (int x = 0 ; x != cWidth ; ++x)
+            {
+                if (!pImage.getPixel(x, y))
+                {
+                    continue;
+                }
+                const int lOutside = std::min(std::min(x + 1, cWidth - x), std::min(y + 1, cHeight - y));
+                int lDistance = lOutside * lOutside;
+                for (int v = 0 ; v != cHeight ; ++v)
+                {
+                    for (int u = 0 ; u != cWidth ; ++u)
+                    {
+                        if (!pImage.getPixel(u, v))
+                        {
+                            lDistance = std::min(lDistance, (u - x) * (u - x) + (v - y) * (v - y));
+                        }
+                    }
+                }
+                lDistances[y * cWidth + x] = lDistance;
+            }
+        }
+        return lDistances;
+    }
+
+    /**
+     LayerMorph::recombine comparing every pair of paths instead of indexing their end points.
+     */
+    static void recombineReference(std::vector<PP::CombinedPathMM>& pPaths, const PP::Tool& pTool)
+    {
+        const float lLimitDist = pTool.getWidthMM() * 2.f;
+        const int cNumPaths = (int)pPaths.size();
+        std::vector<bool> lTaken(cNumPaths, false);
+        for (int i = 0 ; i != cNumPaths ; ++i)
+        {
+            if (lTaken[i])
+            {
+                continue;
+            }
+            PP::CombinedPathMM& lPath = pPaths[i];
+            int lPosition = i;
+            while (!pTool.getNeedsRefill() || lPath.length() <= pTool.getLengthBeforeRefillMM())
+            {
+                int lNext = -1;
+                for (int j = lPosition + 1 ; j < cNumPaths && lNext < 0 ; ++j)
+                {
+                    const PP::CombinedPathMM& lOther = pPaths[j];
+                    if (!lTaken[j]
+                        && (PP::EndpointGrid::areWithin(lPath.mPoints.back(), lOther.mPoints.front(), lLimitDist)
+                            || PP::EndpointGrid::areWithin(lPath.mPoints.back(), lOther.mPoints.back(), lLimitDist)
+                            || PP::EndpointGrid::areWithin(lPath.mPoints.front(), lOther.mPoints.front(), lLimitDist)
+                            || PP::EndpointGrid::areWithin(lPath.mPoints.front(), lOther.mPoints.back(), lLimitDist)))
+                    {
+                        lNext = j;
+                    }
+                }
+                if (lNext < 0)
+                {
+                    break;
+                }
+                lPosition = lNext;
+                PP::CombinedPathMM& lOther = pPaths[lPosition];
+                lTaken[lPosition] = true;
+                if (PP::EndpointGrid::areWithin(lPath.mPoints.back(), lOther.mPoints.front(), lLimitDist))
+                {
+                    lPath.mPoints.insert(lPath.mPoints.end(), lOther.mPoints.begin(), lOther.mPoints.end());
+                }
+                else if (PP::EndpointGrid::areWithin(lPath.mPoints.back(), lOther.mPoints.back(), lLimitDist))
+                {
+                    lPath.mPoints.insert(lPath.mPoints.end(), lOther.mPoints.rbegin(), lOther.mPoints.rend());
+                }
+                else if (PP::EndpointGrid::areWithin(lPath.mPoints.front(), lOther.mPoints.front(), lLimitDist))
+                {
+                    for (auto lPointMM : lOther.mPoints)
+                    {
+                        lPath.mPoints.push_front(lPointMM);
+                    }
+                }
+                else
+                {
+                    lPath.mPoints.insert(lPath.mPoints.begin(), lOther.mPoints.begin(), lOther.mPoints.end());
+                }
+                lOther.mPoints.clear();
+            }
+        }
+        std::vector<PP::CombinedPathMM> lKept;
+        for (int i = 0 ; i != cNumPaths ; ++i)
+        {
+            if (!lTaken[i])
+            {
+                lKept.push_back(pPaths[i]);
+                auto& lPoints = lKept.back().mPoints;
+                lPoints.erase(std::unique(lPoints.begin(), lPoints.end(), [](PP::PointMM a, PP::PointMM b) {
+                    return !(a != b);
+                }), lPoints.end());
+            }
+        }
+        pPaths.swap(lKept);
+    }
+
+    static bool isSame(const std::vector<PP::CombinedPathMM>& pExpected, const std::vector<PP::CombinedPathMM>& pActual)
+    {
+        if (pExpected.size() != pActual.size())
+        {
+            return false;
+        }
+        for (size_t i = 0 ; i != pExpected.size() ; ++i)
+        {
+            if (pExpected[i].mPoints.size() != pActual[i].mPoints.size()
+                || !std::equal(pExpected[i].mPoints.begin(), pExpected[i].mPoints.end(), pActual[i].mPoints.begin(), [](PP::PointMM a, PP::PointMM b) {
+                    return !(a != b);
+                }))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     Compares the kernels to their references on pMask, described by pCase in the messages.
+     */
+    static void checkMask(const PP::BinaryImage& pMask, const std::string& pCase, Checker& pChecker)
+    {
+        const int cWidth = (int)pMask.getWidth();
+        const int cHeight = (int)pMask.getHeight();
+        const PP::PackedBinaryImage cPacked(pMask);
+
+        // packing
+        size_t lNumPixels = 0;
+        for (int y = 0 ; y != cHeight ; ++y)
+        {
+            for (int x = 0 ; x != cWidth ; ++x)
+            {
+                lNumPixels += pMask.getPixel(x, y) ? 1 : 0;
+            }
+        }
+        pChecker.expect(getDifference(pMask, cPacked).empty(), "PackedBinaryImage::toBinaryImage", pCase, getDifference(pMask, cPacked));
+        pChecker.expect(cPacked.countPixels() == lNumPixels, "PackedBinaryImage::countPixels", pCase,
+                        "expected " + std::to_string(lNumPixels) + ", got " + std::to_string(cPacked.countPixels()));
+
+        // thinning, one iteration by every kernel and any number of iterations
+        PP::BinaryImage lThinnedOnce(pMask);
+        PP::MorphOps::thinReference(lThinnedOnce);
+        for (int k = PP::Thinning::eScalarKernel ; k <= PP::Thinning::getBestKernel() ; ++k)
+        {
+            const char* lNames[] = {"Thinning::thin, scalar", "Thinning::thin, SSE2", "Thinning::thin, AVX2"};
+            PP::BinaryImage lThinned(pMask);
+            PP::Thinning::thin(lThinned, (PP::Thinning::Kernel)k);
+            pChecker.expect(getDifference(lThinnedOnce, lThinned).empty(), lNames[k], pCase, getDifference(lThinnedOnce, lThinned));
+        }
+        PP::PackedBinaryImage lPacked(cPacked);
+        PP::MorphOps::thin(lPacked);
+        pChecker.expect(getDifference(lThinnedOnce, lPacked).empty(), "MorphOps::thin", pCase, getDifference(lThinnedOnce, lPacked));
+        PP::BinaryImage lSkeleton(pMask);
+        for (int lIterations : {1, 2, 5, PP::MorphOps::cUntilConvergence})
+        {
+            PP::BinaryImage lExpected(pMask);
+            const int lExpectedPasses = thinReference(lExpected, lIterations);
+            lPacked = cPacked;
+            const int lPasses = PP::MorphOps::thin(lPacked, lIterations);
+            const std::string lCase = pCase + ", " + std::to_string(lIterations) + " iterations";
+            pChecker.expect(getDifference(lExpected, lPacked).empty(), "MorphOps::thin, incremental", lCase, getDifference(lExpected, lPacked));
+            pChecker.expect(lPasses == lExpectedPasses, "MorphOps::thin, incremental passes", lCase,
+                            "expected " + std::to_string(lExpectedPasses) + ", got " + std::to_string(lPasses));
+            if (lIterations == PP::MorphOps::cUntilConvergence)
+            {
+                lSkeleton = lExpected;
+            }
+        }
+
+        // 3x3 operators
+        PP::BinaryImage lExpected(pMask);
+        PP::MorphOps::erode(lExpected);
+        lPacked = cPacked;
+        PP::MorphOps::erode(lPacked);
+        pChecker.expect(getDifference(lExpected, lPacked).empty(), "MorphOps::erode", pCase, getDifference(lExpected, lPacked));
+
+        lExpected = pMask;
+        const PP::BinaryImage lExpectedBorder = PP::MorphOps::removeBorder(lExpected);
+        lPacked = cPacked;
+        const PP::PackedBinaryImage lBorder = PP::MorphOps::removeBorder(lPacked);
+        pChecker.expect(getDifference(lExpected, lPacked).empty(), "MorphOps::removeBorder", pCase, getDifference(lExpected, lPacked));
+        pChecker.expect(getDifference(lExpectedBorder, lBorder).empty(), "MorphOps::removeBorder, border", pCase, getDifference(lExpectedBorder, lBorder));
+
+        lExpected = pMask;
+        PP::MorphOps::median(lExpected);
+        lPacked = cPacked;
+        PP::MorphOps::median(lPacked);
+        pChecker.expect(getDifference(lExpected, lPacked).empty(), "MorphOps::median", pCase, getDifference(lExpected, lPacked));
+
+        for (int lStep : {1, 2, 3, 7})
+        {
+            for (bool lDirection : {false, true})
+            {
+                lExpected = PP::MorphOps::diagonal(pMask, lStep, lDirection);
+                const PP::PackedBinaryImage lDiagonal = PP::MorphOps::diagonal(cPacked, lStep, lDirection);
+                pChecker.expect(getDifference(lExpected, lDiagonal).empty(), "MorphOps::diagonal", pCase + ", step " + std::to_string(lStep)
+                                + (lDirection ? ", down" : ", up"), getDifference(lExpected, lDiagonal));
+            }
+        }
+
+        // structuring elements, whose references cost the area of the element per pixel, and the largest radius
+        // crossing whole words only on small images
+        if (cWidth * cHeight <= 4096)
+        {
+            const char* lNames[] = {"square", "diamond", "octagon"};
+            std::vector<int> lRadii = {1, 2, 3, 5, 6};
+            if (cWidth * cHeight <= 256)
+            {
+                lRadii.push_back(65);
+            }
+            for (PP::MorphOps::StructuringElement lElement : {PP::MorphOps::eSquareElement, PP::MorphOps::eDiamondElement, PP::MorphOps::eOctagonElement})
+            {
+                for (int lRadius : lRadii)
+                {
+                    const std::vector<PP::PointPixel> lOffsets = getElementOffsets(lElement, lRadius);
+                    const std::string lCase = pCase + ", radius " + std::to_string(lRadius);
+                    lExpected = filterReference(pMask, lOffsets, false);
+                    lPacked = cPacked;
+                    PP::MorphOps::erode(lPacked, lElement, lRadius);
+                    pChecker.expect(getDifference(lExpected, lPacked).empty(), std::string("MorphOps::erode ") + lNames[lElement], lCase, getDifference(lExpected, lPacked));
+                    lExpected = filterReference(pMask, lOffsets, true);
+                    lPacked = cPacked;
+                    PP::MorphOps::dilate(lPacked, lElement, lRadius);
+                    pChecker.expect(getDifference(lExpected, lPacked).empty(), std::string("MorphOps::dilate ") + lNames[lElement], lCase, getDifference(lExpected, lPacked));
+                }
+            }
+        }
+
+        // distance transform, whose reference costs the area of the image per pixel
+        if (cWidth * cHeight <= 2048)
+        {
+            const std::vector<int> lExpectedDistances = squaredDistanceTransformReference(pMask);
+            const std::vector<int> lDistances = PP::MorphOps::squaredDistanceTransform(cPacked);
+            size_t lFirst = 0;
+            while (lFirst != lDistances.size() && lDistances[lFirst] == lExpectedDistances[lFirst])
+            {
+                ++lFirst;
+            }
+            pChecker.expect(lFirst == lDistances.size(), "MorphOps::squaredDistanceTransform", pCase, (lFirst == lDistances.size()) ? std::string()
+                            : "at (" + std::to_string(lFirst % cWidth) + ", " + std::to_string(lFirst / cWidth) + ") expected "
+                            + std::to_string(lExpectedDistances[lFirst]) + ", got " + std::to_string(lDistances[lFirst]));
+        }
+
+        // tracing of the skeleton: every pixel is on a path, and every path goes from a pixel to a neighbour
+        const std::vector<PP::CombinedPathsPixels> lPathsPixels = PP::SkeletonTracer(lSkeleton).trace();
+        PP::BinaryImage lTraced(cWidth, cHeight);
+        std::string lTraceError;
+        for (const PP::CombinedPathsPixels& lPath : lPathsPixels)
+        {
+            const PP::PointPixel* lPrevious = nullptr;
+            for (const PP::PointPixel& p : lPath.mPoints)
+            {
+                if (p.mX < 0 || p.mY < 0 || p.mX >= cWidth || p.mY >= cHeight || !lSkeleton.getPixel(p.mX, p.mY))
+                {
+                    lTraceError = "(" + std::to_string(p.mX) + ", " + std::to_string(p.mY) + ") is not in the skeleton";
+                    break;
+                }
+                if (lPrevious && std::max(std::abs(p.mX - lPrevious->mX), std::abs(p.mY - lPrevious->mY)) != 1)
+                {
+                    lTraceError = "(" + std::to_string(p.mX) + ", " + std::to_string(p.mY) + ") is not next to ("
+                            + std::to_string(lPrevious->mX) + ", " + std::to_string(lPrevious->mY) + ")";
+                    break;
+                }
+                lTraced.getPixel(p.mX, p.mY) = true;
+                lPrevious = &p;
+            }
+        }
+        if (lTraceError.empty())
+        {
+            lTraceError = getDifference(lSkeleton, lTraced);
+        }
+        pChecker.expect(lTraceError.empty(), "SkeletonTracer::trace", pCase, lTraceError);
+
+        // chaining of the traced paths, with and without refills
+        const float cMMperPixel = 0.25f;
+        std::vector<PP::CombinedPathMM> lTracedMM;
+        for (const PP::CombinedPathsPixels& lPath : lPathsPixels)
+        {
+            PP::CombinedPathMM lPathMM;
+            for (PP::PointPixel p : lPath.mPoints)
+            {
+                lPathMM.mPoints.push_back({p.mX * cMMperPixel, p.mY * cMMperPixel});
+            }
+            lTracedMM.push_back(lPathMM);
+        }
+        for (const PP::Tool& lTool : {PP::Tool::noRefillTool("Check pen", 0.3f, QColor(0, 0, 0), 0.f, 0),
+                                      PP::Tool::refillingTool("Check brush", 0.6f, QColor(0, 0, 0), 0.f, 5.f, "G0 Z10\n", 0)})
+        {
+            std::vector<PP::CombinedPathMM> lExpectedPaths = lTracedMM;
+            recombineReference(lExpectedPaths, lTool);
+            std::vector<PP::CombinedPathMM> lPaths = lTracedMM;
+            PP::LayerMorph::recombine(lPaths, lTool);
+            pChecker.expect(isSame(lExpectedPaths, lPaths), "LayerMorph::recombine", pCase + (lTool.getNeedsRefill() ? ", refills" : ", no refill"),
+                            std::to_string(lExpectedPaths.size()) + " paths expected, " + std::to_string(lPaths.size()) + " got");
+        }
+    }
+
+    /**
+     Compares the masks of the threshold bands of a random image of pWidth x pHeight to the thresholded lightness.
+     */
+    static void checkBands(int pWidth, int pHeight, std::mt19937& pRandom, const std::string& pCase, Checker& pChecker)
+    {
+        QImage lImage(pWidth, pHeight, QImage::Format_RGB32);
+        std::uniform_int_distribution<int> lChannel(0, 255);
+        for (int y = 0 ; y != pHeight ; ++y)
+        {
+            for (int x = 0 ; x != pWidth ; ++x)
+            {
+                lImage.setPixel(x, y, qRgb(lChannel(pRandom), lChannel(pRandom), lChannel(pRandom)));
+            }
+        }
+        const PP::LightnessImage lLightness(lImage);
+        const std::vector<float> lThresholds = {0.25f, 0.45f, 0.65f, 0.85f};
+        const PP::ThresholdBands lBands(lLightness, lThresholds);
+        for (float lThreshold : lThresholds)
+        {
+            PP::BinaryImage lExpected(lLightness, lThreshold);
+            lExpected.invert();
+            const PP::PackedBinaryImage lMask = lBands.getDarkerMask(lThreshold);
+            pChecker.expect(getDifference(lExpected, lMask).empty(), "ThresholdBands::getDarkerMask", pCase + ", threshold "
+                            + std::to_string(lThreshold), getDifference(lExpected, lMask));
+        }
+    }
+
+    /**
+     Compares the kernels to their references on random masks of every pattern and of sizes covering single rows,
+     single columns, single pixels, and widths on both sides of the word size. pSeed gives the masks.
+     */
+    static void checkKernels(unsigned pSeed, Checker& pChecker)
+    {
+        const int cWidths[] = {1, 2, 3, 5, 31, 63, 64, 65, 127, 128, 129, 0};
+        const int cHeights[] = {1, 2, 3, 7, 64, 0};
+        std::mt19937 lRandom(pSeed);
+        int lNumMasks = 0;
+        for (int lWidthOrRandom : cWidths)
+        {
+            for (int lHeightOrRandom : cHeights)
+            {
+                // 0 is an odd random size
+                const int lWidth = (lWidthOrRandom != 0) ? lWidthOrRandom : 2 * std::uniform_int_distribution<int>(1, 100)(lRandom) + 1;
+                const int lHeight = (lHeightOrRandom != 0) ? lHeightOrRandom : 2 * std::uniform_int_distribution<int>(1, 50)(lRandom) + 1;
+                const std::string lSize = std::to_string(lWidth) + "x" + std::to_string(lHeight);
+                checkBands(lWidth, lHeight, lRandom, lSize + " random colors", pChecker);
+                for (int p = 0 ; p != eNumPatterns ; ++p)
+                {
+                    const PP::BinaryImage lMask = generateMask(lWidth, lHeight, (Pattern)p, lRandom);
+                    checkMask(lMask, lSize + " " + getPatternName((Pattern)p) + " mask #" + std::to_string(lNumMasks++)
+                              + " of seed " + std::to_string(pSeed), pChecker);
+                }
+            }
+        }
+    }
+
+    /**
+     Parameters of a compilation whose results are kept as reference.
+     */
+    struct GoldenCase
+    {
+        const char* mName;
+        PP::LayerMorph::FillMode mFillMode;
+        bool mRefill;
+        float mToolWidthMM;
+        float mSimplificationTolerance;
+        PP::CurveFitter::Mode mCurveFitting;
+    };
+
+    /**
+     64-bit FNV-1a hash of pSize bytes, continuing pHash, as 16 hexadecimal digits once done.
+     */
+    static uint64_t hash(const void* pData, size_t pSize, uint64_t pHash = 14695981039346656037ull)
+    {
+        const unsigned char* lBytes = static_cast<const unsigned char*>(pData);
+        for (size_t u = 0 ; u != pSize ; ++u)
+        {
+            pHash = (pHash ^ lBytes[u]) * 1099511628211ull;
+        }
+        return pHash;
+    }
+
+    static std::string toHex(uint64_t pHash)
+    {
+        char lHex[17];
+        std::snprintf(lHex, sizeof(lHex), "%016llx", (unsigned long long)pHash);
+        return lHex;
+    }
+
+    /**
+     Hashes of the essential image and of the G-code of every layer of pImage compiled with every golden case, by
+     "<input> | <case> | layer <threshold>".
+     The layers keep the default settings but those of the case, so that the results are those of a default run.
+     */
+    static void computeGolden(const std::string& pInput, const QImage& pImage, std::map<std::string, std::pair<std::string, std::string>>& pHashes)
+    {
+        const GoldenCase cCases[] = {
+            {"hatch, refilled 1.5 mm brush, lines", PP::LayerMorph::eHatchFill, true, 1.5f, 0.1f, PP::CurveFitter::eLines},
+            {"concentric, refilled 1.5 mm brush, arcs", PP::LayerMorph::eConcentricFill, true, 1.5f, 0.1f, PP::CurveFitter::eArcs},
+            {"hatch, 0.8 mm pen, cubics", PP::LayerMorph::eHatchFill, false, 0.8f, 0.1f, PP::CurveFitter::eArcsAndCubics},
+            {"hatch, 0.8 mm pen, unsimplified", PP::LayerMorph::eHatchFill, false, 0.8f, 0.f, PP::CurveFitter::eLines}
+        };
+        const float cWidthMM = 80.f;
+        const std::vector<float> lThresholds = {0.25f, 0.45f, 0.65f, 0.85f};
+        const PP::ThresholdBands lBands(PP::LightnessImage(pImage), lThresholds);
+        for (const GoldenCase& lCase : cCases)
+        {
+            const PP::Tool lTool = lCase.mRefill
+                    ? PP::Tool::refillingTool("Golden brush", lCase.mToolWidthMM, QColor(0x70, 0x42, 0x14), 2.5f, 300.f, "G0 Z10\nG0 X0 Y0\nG0 Z0\nG0 Z10\n", 20)
+                    : PP::Tool::noRefillTool("Golden pen", lCase.mToolWidthMM, QColor(0, 0, 0), 0.5f, 10);
+            for (size_t i = 0 ; i != lThresholds.size() ; ++i)
+            {
+                PP::LayerMorph lLayer(lThresholds[i], lCase.mFillMode);
+                lLayer.setHatchDirection((i + 1) % 2 == 0);
+                lLayer.setSimplificationTolerance(lCase.mSimplificationTolerance);
+                lLayer.setCurveFitting(lCase.mCurveFitting);
+
+                const PP::BinaryImage lEssential = lLayer.essentialize(lBands, cWidthMM, lTool);
+                const uint64_t lSize[2] = {lEssential.getWidth(), lEssential.getHeight()};
+                uint64_t lEssentialHash = hash(lSize, sizeof(lSize));
+                for (size_t y = 0 ; y != lEssential.getHeight() ; ++y)
+                {
+                    for (size_t x = 0 ; x != lEssential.getWidth() ; ++x)
+                    {
+                        const unsigned char lPixel = lEssential.getPixel(x, y) ? 1 : 0;
+                        lEssentialHash = hash(&lPixel, 1, lEssentialHash);
+                    }
+                }
+
+                PP::GCodeWriter lGCode;
+                PP::LayerStatistics lStatistics;
+                lLayer.compile(lBands, 200.f, 200.f, cWidthMM, lTool, lGCode, lStatistics);
+                uint64_t lGCodeHash = hash(nullptr, 0);
+                for (const std::string& lChunk : lGCode.takeChunks())
+                {
+                    lGCodeHash = hash(lChunk.data(), lChunk.size(), lGCodeHash);
+                }
+
+                char lLayerName[32];
+                std::snprintf(lLayerName, sizeof(lLayerName), "layer %.2f", lThresholds[i]);
+                pHashes[pInput + " | " + lCase.mName + " | " + lLayerName] = {toHex(lEssentialHash), toHex(lGCodeHash)};
+            }
+        }
+    }
+
+    /**
+     Writes pHashes to the reference file pPath. Returns false if it could not be written.
+     */
+    static bool writeGolden(const std::string& pPath, const std::map<std::string, std::pair<std::string, std::string>>& pHashes)
+    {
+        QJsonObject lCases;
+        for (const auto& lHashes : pHashes)
+        {
+            QJsonObject lCase;
+            lCase.insert("essential", QString::fromStdString(lHashes.second.first));
+            lCase.insert("gcode", QString::fromStdString(lHashes.second.second));
+            lCases.insert(QString::fromStdString(lHashes.first), lCase);
+        }
+        QJsonObject lGolden;
+        lGolden.insert("cases", lCases);
+        QSaveFile lFile(QString::fromStdString(pPath));
+        return lFile.open(QIODevice::WriteOnly) && lFile.write(QJsonDocument(lGolden).toJson()) >= 0 && lFile.commit();
+    }
+
+    /**
+     Compares pHashes to the reference file pPath, a case that is not in the reference being a mismatch, and a case of
+     the reference that was not computed being reported only. Returns false if the reference could not be read.
+     */
+    static bool compareGolden(const std::string& pPath, const std::map<std::string, std::pair<std::string, std::string>>& pHashes, Checker& pChecker)
+    {
+        QFile lFile(QString::fromStdString(pPath));
+        if (!lFile.open(QIODevice::ReadOnly))
+        {
+            std::cerr << "Could not open the reference " << pPath << std::endl;
+            return false;
+        }
+        QJsonParseError lParseError;
+        const QJsonObject lCases = QJsonDocument::fromJson(lFile.readAll(), &lParseError).object().value("cases").toObject();
+        if (lParseError.error != QJsonParseError::NoError)
+        {
+            std::cerr << "Could not parse the reference " << pPath << " at offset " << lParseError.offset << ": "
+                      << lParseError.errorString().toStdString() << std::endl;
+            return false;
+        }
+        for (const auto& lHashes : pHashes)
+        {
+            const QString lName = QString::fromStdString(lHashes.first);
+            if (!lCases.contains(lName))
+            {
+                pChecker.expect(false, "golden essential image", lHashes.first, "not in the reference");
+                continue;
+            }
+            const QJsonObject lCase = lCases.value(lName).toObject();
+            const std::string lEssential = lCase.value("essential").toString().toStdString();
+            const std::string lGCode = lCase.value("gcode").toString().toStdString();
+            pChecker.expect(lEssential == lHashes.second.first, "golden essential image", lHashes.first,
+                            "expected " + lEssential + ", got " + lHashes.second.first);
+            pChecker.expect(lGCode == lHashes.second.second, "golden G-code", lHashes.first,
+                            "expected " + lGCode + ", got " + lHashes.second.second);
+        }
+        for (auto lIt = lCases.constBegin() ; lIt != lCases.constEnd() ; ++lIt)
+        {
+            if (pHashes.count(lIt.key().toStdString()) == 0)
+            {
+                std::printf("not computed: %s\n", lIt.key().toStdString().c_str());
+            }
+        }
+        return true;
+    }
+}
+
+#endif
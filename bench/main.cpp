@@ -0,0 +1,464 @@
+/**
+  @file      main.cpp
+  @copyright François Becker
+  @date      2017-2018
+  */
+
+#include "check.hpp"
+#include "pp_curvefitter.hpp"
+#include "pp_distancetransform.hpp"
+#include "pp_gcodewriter.hpp"
+#include "pp_layermorph.hpp"
+#include "pp_lightnessimage.hpp"
+#include "pp_packedbinaryimage.hpp"
+#include "pp_refillscheduler.hpp"
+#include "pp_skeletontracer.hpp"
+#include "pp_structuringelement.hpp"
+#include "pp_thinning.hpp"
+#include "pp_threadpool.hpp"
+#include "pp_thresholdbands.hpp"
+#include "pp_tool.hpp"
+
+#include <QImage>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef PP_RESOURCES_DIR
+#define PP_RESOURCES_DIR "resources"
+#endif
+
+/**
+ Times every stage of the compilation of a layer on the example image and on generated images of growing sizes, for
+ growing numbers of threads, and prints the time of each one with its throughput and its speedup.
+ With -check, -record or -compare, checks the results of the stages instead of timing them.
+ */
+struct BenchConfig
+{
+    std::vector<std::string> mImagePaths;
+    int         mMaxSize = 8192;
+    std::vector<int> mNumThreads;
+    int         mRepetitions = 3;
+    bool        mCheck = false;
+    bool        mGeneratedOnly = false;
+    unsigned    mSeed = 1;
+    std::string mRecordPath;
+    std::string mComparePath;
+
+    BenchConfig(int argc, char* argv[])
+    {
+        for (int i = 1 ; i < argc ; ++i)
+        {
+            const std::string lArg = argv[i];
+            if (lArg == "-i" && i + 1 < argc)
+            {
+                mImagePaths.push_back(argv[++i]);
+            }
+            else if (lArg == "-s" && i + 1 < argc && std::atoi(argv[i + 1]) >= 256)
+            {
+                mMaxSize = std::atoi(argv[++i]);
+            }
+            else if (lArg == "-j" && i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+            {
+                mNumThreads.push_back(std::atoi(argv[++i]));
+            }
+            else if (lArg == "-r" && i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+            {
+                mRepetitions = std::atoi(argv[++i]);
+            }
+            else if (lArg == "-check")
+            {
+                mCheck = true;
+            }
+            else if (lArg == "-generated")
+            {
+                mGeneratedOnly = true;
+            }
+            else if (lArg == "-seed" && i + 1 < argc)
+            {
+                mSeed = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+            }
+            else if (lArg == "-record" && i + 1 < argc)
+            {
+                mRecordPath = argv[++i];
+            }
+            else if (lArg == "-compare" && i + 1 < argc)
+            {
+                mComparePath = argv[++i];
+            }
+            else
+            {
+                std::cerr << "Did not understand this argument: " << lArg << std::endl;
+                std::cerr << usage() << std::flush;
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (mImagePaths.empty() && !mGeneratedOnly)
+        {
+            mImagePaths.push_back(PP_RESOURCES_DIR "/dogs-2921382-640.jpg");
+        }
+        if (mNumThreads.empty())
+        {
+            for (int n = 1 ; n < PP::ThreadPool::getDefaultNumThreads() ; n *= 2)
+            {
+                mNumThreads.push_back(n);
+            }
+            mNumThreads.push_back(PP::ThreadPool::getDefaultNumThreads());
+        }
+    }
+
+    static std::string usage()
+    {
+        return std::string("")
+                + "Usage:\n"
+                  "PaintPrintBench\n"
+                  "      -i <image path> benchmarked besides the generated images, this argument can be used multiple times, defaults to the example image\n"
+                  "      -generated uses only the generated images, without the example image by default\n"
+                  "      -s <size in pixels> of the largest generated image, from 256 doubling up to it, defaults to 8192\n"
+                  "      -j <number of threads> this argument can be used multiple times, defaults to powers of 2 up to the number of cores\n"
+                  "      -r <number of repetitions> of every measure, whose median is reported, defaults to 3\n"
+                  "   checks, instead of timing, for every number of threads:\n"
+                  "      -check compares the optimized kernels to their scalar references on random masks of all the sizes that have edge cases\n"
+                  "      -seed <number> of the random masks, defaults to 1\n"
+                  "      -record <golden.json> writes the hashes of the essential images and of the G-code of every layer of the images, generated ones up to 512 pixels, for a few sets of parameters\n"
+                  "      -compare <golden.json> compares them to the hashes written by -record, resources/golden.json being recorded with -generated\n";
+    }
+
+    bool isChecking() const
+    {
+        return mCheck || !mRecordPath.empty() || !mComparePath.empty();
+    }
+};
+
+/**
+ Square image of pSize pixels whose darker areas, at every threshold, are blobs and bands about as large in
+ millimetres whatever the size, as if the same print were made from a finer scan.
+ */
+static QImage generateImage(int pSize)
+{
+    QImage lImage(pSize, pSize, QImage::Format_RGB32);
+    for (int y = 0 ; y != pSize ; ++y)
+    {
+        QRgb* lRow = reinterpret_cast<QRgb*>(lImage.scanLine(y));
+        const float v = (float)y / pSize;
+        for (int x = 0 ; x != pSize ; ++x)
+        {
+            const float u = (float)x / pSize;
+            const float lLightness = 0.5f + 0.3f * std::sin(12.f * u + 3.f * std::sin(9.f * v)) * std::cos(10.f * v) + 0.2f * (u - 0.5f);
+            const int lGrey = std::max(0, std::min(255, (int)(255.f * lLightness)));
+            lRow[x] = qRgb(lGrey, lGrey, lGrey);
+        }
+    }
+    return lImage;
+}
+
+/**
+ Median time of pRepetitions calls of pRun, in seconds, pSetUp being called before every one, untimed.
+ */
+template <typename SetUp, typename Run>
+static double measure(int pRepetitions, SetUp pSetUp, Run pRun)
+{
+    std::vector<double> lSeconds;
+    for (int r = 0 ; r != pRepetitions ; ++r)
+    {
+        pSetUp();
+        const auto lStart = std::chrono::steady_clock::now();
+        pRun();
+        lSeconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - lStart).count());
+    }
+    std::sort(lSeconds.begin(), lSeconds.end());
+    return lSeconds[lSeconds.size() / 2];
+}
+
+/**
+ Prints the measures, the speedup of a stage being relative to the first number of threads it was measured with.
+ */
+class Report
+{
+public:
+    Report()
+    {
+        std::printf("%-22s %-34s %7s %12s %22s %8s\n", "input", "stage", "threads", "time (ms)", "throughput", "speedup");
+    }
+
+    void add(const std::string& pInput, const std::string& pStage, int pNumThreads, double pSeconds, double pNumItems, const char* pItems)
+    {
+        const std::string lKey = pInput + "/" + pStage;
+        if (mFirstSeconds.count(lKey) == 0)
+        {
+            mFirstSeconds[lKey] = pSeconds;
+        }
+        char lThroughput[64];
+        std::snprintf(lThroughput, sizeof(lThroughput), "%.3g M%s/s", pNumItems / std::max(pSeconds, 1e-9) / 1e6, pItems);
+        std::printf("%-22s %-34s %7d %12.3f %22s %7.2fx\n", pInput.c_str(), pStage.c_str(), pNumThreads, pSeconds * 1e3,
+                    lThroughput, mFirstSeconds[lKey] / std::max(pSeconds, 1e-9));
+        std::fflush(stdout);
+    }
+
+private:
+    std::map<std::string, double> mFirstSeconds;
+};
+
+/**
+ Times the stages on pImage, each one from the result of the previous ones.
+ */
+static void benchmark(const std::string& pInput, const QImage& pImage, int pNumThreads, int pRepetitions, Report& pReport)
+{
+    const float cWidthMM = 80.f;
+    const float cThreshold = 0.45f;
+    const PP::Tool cTool = PP::Tool::refillingTool("Bench tool", 1.5f, QColor(0x70, 0x42, 0x14), 2.5f, 300.f, "G0 Z10\nG0 X0 Y0\nG0 Z0\nG0 Z10\n", 20);
+    const int cStepPixels = std::max(1, (int)std::floor(cTool.getWidthMM() * pImage.width() / cWidthMM));
+    const double cNumPixels = (double)pImage.width() * pImage.height();
+    auto lNothing = []() {};
+    auto lAdd = [&](const std::string& pStage, double pSeconds, double pNumItems, const char* pItems) {
+        pReport.add(pInput, pStage, pNumThreads, pSeconds, pNumItems, pItems);
+    };
+
+    // construction of the binary images
+    PP::LightnessImage lLightness;
+    lAdd("LightnessImage", measure(pRepetitions, lNothing, [&]() {
+        lLightness = PP::LightnessImage(pImage);
+    }), cNumPixels, "pixel");
+    PP::ThresholdBands lBands;
+    lAdd("ThresholdBands, 4 thresholds", measure(pRepetitions, lNothing, [&]() {
+        lBands = PP::ThresholdBands(lLightness, {0.25f, 0.45f, 0.65f, 0.85f});
+    }), cNumPixels, "pixel");
+    PP::BinaryImage lBinary(0, 0, false);
+    lAdd("BinaryImage", measure(pRepetitions, lNothing, [&]() {
+        lBinary = PP::BinaryImage(lLightness, cThreshold);
+    }), cNumPixels, "pixel");
+    PP::PackedBinaryImage lMask(0, 0);
+    lAdd("PackedBinaryImage(BinaryImage)", measure(pRepetitions, lNothing, [&]() {
+        lMask = PP::PackedBinaryImage(lBinary);
+    }), cNumPixels, "pixel");
+    lAdd("ThresholdBands::getDarkerMask", measure(pRepetitions, lNothing, [&]() {
+        lMask = lBands.getDarkerMask(cThreshold);
+    }), cNumPixels, "pixel");
+    lAdd("PackedBinaryImage::toBinaryImage", measure(pRepetitions, lNothing, [&]() {
+        lBinary = lMask.toBinaryImage();
+    }), cNumPixels, "pixel");
+
+    // morphological operators, on the mask of the layer
+    PP::PackedBinaryImage lPacked(0, 0);
+    auto lResetPacked = [&]() {
+        lPacked = lMask;
+    };
+    PP::BinaryImage lUnpacked(0, 0, false);
+    lAdd("MorphOps::thin BinaryImage", measure(pRepetitions, [&]() {
+        lUnpacked = lBinary;
+    }, [&]() {
+        PP::MorphOps::thin(lUnpacked);
+    }), cNumPixels, "pixel");
+    lAdd("MorphOps::thin", measure(pRepetitions, lResetPacked, [&]() {
+        PP::MorphOps::thin(lPacked);
+    }), cNumPixels, "pixel");
+    lAdd("MorphOps::thin, tool width / 2", measure(pRepetitions, lResetPacked, [&]() {
+        PP::MorphOps::thin(lPacked, cStepPixels / 2);
+    }), cNumPixels, "pixel");
+    lAdd("MorphOps::erode", measure(pRepetitions, lResetPacked, [&]() {
+        PP::MorphOps::erode(lPacked);
+    }), cNumPixels, "pixel");
+    lAdd("MorphOps::erode square, width / 4", measure(pRepetitions, lResetPacked, [&]() {
+        PP::MorphOps::erode(lPacked, PP::MorphOps::eSquareElement, std::max(cStepPixels / 4, 1));
+    }), cNumPixels, "pixel");
+    lAdd("MorphOps::dilate diamond, width / 4", measure(pRepetitions, lResetPacked, [&]() {
+        PP::MorphOps::dilate(lPacked, PP::MorphOps::eDiamondElement, std::max(cStepPixels / 4, 1));
+    }), cNumPixels, "pixel");
+    lAdd("MorphOps::dilate octagon, width / 4", measure(pRepetitions, lResetPacked, [&]() {
+        PP::MorphOps::dilate(lPacked, PP::MorphOps::eOctagonElement, std::max(cStepPixels / 4, 1));
+    }), cNumPixels, "pixel");
+    lAdd("MorphOps::removeBorder", measure(pRepetitions, lResetPacked, [&]() {
+        PP::MorphOps::removeBorder(lPacked);
+    }), cNumPixels, "pixel");
+    lAdd("MorphOps::median", measure(pRepetitions, lResetPacked, [&]() {
+        PP::MorphOps::median(lPacked);
+    }), cNumPixels, "pixel");
+    lAdd("MorphOps::diagonal", measure(pRepetitions, lNothing, [&]() {
+        PP::MorphOps::diagonal(lMask, cStepPixels, false);
+    }), cNumPixels, "pixel");
+    lAdd("MorphOps::squaredDistanceTransform", measure(pRepetitions, lNothing, [&]() {
+        PP::MorphOps::squaredDistanceTransform(lMask);
+    }), cNumPixels, "pixel");
+    lAdd("MorphOps::concentricContours", measure(pRepetitions, lNothing, [&]() {
+        PP::MorphOps::concentricContours(lMask, cStepPixels, 1);
+    }), cNumPixels, "pixel");
+
+    // essential images, by a new layer every time so that they are not kept
+    PP::BinaryImage lEssential(0, 0, false);
+    lAdd("essentialize, hatched", measure(pRepetitions, lNothing, [&]() {
+        lEssential = PP::LayerMorph(cThreshold, PP::LayerMorph::eHatchFill).essentialize(lBands, cWidthMM, cTool);
+    }), cNumPixels, "pixel");
+    lAdd("essentialize, concentric", measure(pRepetitions, lNothing, [&]() {
+        PP::LayerMorph(cThreshold, PP::LayerMorph::eConcentricFill).essentialize(lBands, cWidthMM, cTool);
+    }), cNumPixels, "pixel");
+
+    // strokes
+    std::vector<PP::CombinedPathsPixels> lPathsPixels;
+    lAdd("SkeletonTracer, path combining", measure(pRepetitions, lNothing, [&]() {
+        lPathsPixels = PP::SkeletonTracer(lEssential).trace();
+    }), cNumPixels, "pixel");
+    const float cMMperPixel = cWidthMM / pImage.width();
+    std::vector<PP::CombinedPathMM> lTraced;
+    for (const PP::CombinedPathsPixels& lPath : lPathsPixels)
+    {
+        PP::CombinedPathMM lPathMM;
+        for (PP::PointPixel lPoint : lPath.mPoints)
+        {
+            lPathMM.mPoints.push_back({100.f + cWidthMM / 2.f - lPoint.mX * cMMperPixel, 100.f + lPoint.mY * cMMperPixel});
+        }
+        lTraced.push_back(lPathMM);
+    }
+    std::vector<PP::CombinedPathMM> lStrokes;
+    lAdd("LayerMorph::recombine", measure(pRepetitions, [&]() {
+        lStrokes = lTraced;
+    }, [&]() {
+        PP::LayerMorph::recombine(lStrokes, cTool);
+    }), (double)lTraced.size(), "stroke");
+    for (auto& lStroke : lStrokes)
+    {
+        lStroke.simplify(0.1f * cTool.getWidthMM());
+    }
+    std::vector<PP::CombinedPathMM> lOrdered;
+    std::vector<std::vector<PP::CombinedPathMM>> lBatches;
+    PP::LayerStatistics lStatistics;
+    lAdd("RefillScheduler, 100 ms budget", measure(pRepetitions, [&]() {
+        lOrdered = lStrokes;
+    }, [&]() {
+        lBatches = PP::RefillScheduler(cTool, 100.f).schedule(lOrdered, lStatistics);
+    }), (double)lStrokes.size(), "stroke");
+    std::vector<PP::CombinedPathMM> lFixed;
+    lAdd("CombinedPathMM::fixDragError", measure(pRepetitions, [&]() {
+        lFixed = lStrokes;
+    }, [&]() {
+        for (auto& lStroke : lFixed)
+        {
+            lStroke.fixDragError(cTool.getDragErrorMM());
+        }
+    }), (double)lStrokes.size(), "stroke");
+    for (PP::CurveFitter::Mode lMode : {PP::CurveFitter::eLines, PP::CurveFitter::eArcs, PP::CurveFitter::eArcsAndCubics})
+    {
+        const PP::CurveFitter lFitter(lMode, 0.1f * cTool.getWidthMM());
+        const char* lNames[] = {"G-code emission, lines", "G-code emission, arcs", "G-code emission, cubics"};
+        lAdd(lNames[lMode], measure(pRepetitions, lNothing, [&]() {
+            PP::GCodeWriter lGCode;
+            for (const auto& lStroke : lFixed)
+            {
+                lFitter.compile(lStroke, lGCode);
+            }
+        }), (double)lFixed.size(), "stroke");
+    }
+
+    // whole layer
+    lAdd("LayerMorph::compile", measure(pRepetitions, lNothing, [&]() {
+        PP::GCodeWriter lGCode;
+        PP::LayerMorph(cThreshold).compile(lBands, 200.f, 200.f, cWidthMM, cTool, lGCode, lStatistics);
+    }), cNumPixels, "pixel");
+}
+
+/**
+ Checks the kernels against their references and the results of the stages on pInputs against the reference file,
+ for every number of threads, the results having to be the same whatever the number of threads.
+ Returns false on a mismatch or if the reference could not be read or written.
+ */
+static bool check(const BenchConfig& pConfig, const std::vector<std::pair<std::string, QImage>>& pInputs)
+{
+    Check::Checker lChecker;
+    std::map<std::string, std::pair<std::string, std::string>> lFirstHashes;
+    for (int lNumThreads : pConfig.mNumThreads)
+    {
+        PP::ThreadPool::getInstance().setNumThreads(lNumThreads);
+        std::printf("checking with %d threads\n", lNumThreads);
+        std::fflush(stdout);
+        if (pConfig.mCheck)
+        {
+            Check::checkKernels(pConfig.mSeed, lChecker);
+        }
+        if (pConfig.mRecordPath.empty() && pConfig.mComparePath.empty())
+        {
+            continue;
+        }
+        std::map<std::string, std::pair<std::string, std::string>> lHashes;
+        for (const auto& lInput : pInputs)
+        {
+            Check::computeGolden(lInput.first, lInput.second, lHashes);
+        }
+        if (lFirstHashes.empty())
+        {
+            lFirstHashes = lHashes;
+        }
+        else
+        {
+            for (const auto& lFirst : lFirstHashes)
+            {
+                lChecker.expect(lHashes[lFirst.first] == lFirst.second, "golden, same for any number of threads",
+                                lFirst.first + ", " + std::to_string(lNumThreads) + " threads");
+            }
+        }
+        if (!pConfig.mComparePath.empty() && !Check::compareGolden(pConfig.mComparePath, lHashes, lChecker))
+        {
+            return false;
+        }
+    }
+    const bool lSame = lChecker.report();
+    if (!pConfig.mRecordPath.empty())
+    {
+        if (!lSame)
+        {
+            std::cerr << "The reference " << pConfig.mRecordPath << " was not written, as the results do not match" << std::endl;
+            return false;
+        }
+        if (!Check::writeGolden(pConfig.mRecordPath, lFirstHashes))
+        {
+            std::cerr << "Could not write the reference " << pConfig.mRecordPath << std::endl;
+            return false;
+        }
+        std::printf("%zu cases written to %s\n", lFirstHashes.size(), pConfig.mRecordPath.c_str());
+    }
+    return lSame;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchConfig lConfig(argc, argv);
+
+    std::vector<std::pair<std::string, QImage>> lInputs;
+    for (const std::string& lPath : lConfig.mImagePaths)
+    {
+        QImage lImage;
+        if (!lImage.load(lPath.c_str()))
+        {
+            std::cerr << "Could not load image " << lPath << ", skipped" << std::endl;
+            continue;
+        }
+        const std::string lName = lPath.substr(lPath.find_last_of("/\\") + 1);
+        lInputs.push_back({lName + " " + std::to_string(lImage.width()) + "x" + std::to_string(lImage.height()), lImage});
+    }
+    // the results are checked on the smaller generated images only
+    const int cMaxSize = lConfig.isChecking() ? std::min(lConfig.mMaxSize, 512) : lConfig.mMaxSize;
+    for (int lSize = 256 ; lSize <= cMaxSize ; lSize *= 2)
+    {
+        lInputs.push_back({"generated " + std::to_string(lSize) + "x" + std::to_string(lSize), generateImage(lSize)});
+    }
+
+    if (lConfig.isChecking())
+    {
+        return check(lConfig, lInputs) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    Report lReport;
+    for (const auto& lInput : lInputs)
+    {
+        for (int lNumThreads : lConfig.mNumThreads)
+        {
+            PP::ThreadPool::getInstance().setNumThreads(lNumThreads);
+            benchmark(lInput.first, lInput.second, lNumThreads, lConfig.mRepetitions, lReport);
+        }
+    }
+}
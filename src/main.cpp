@@ -7,8 +7,15 @@
 #include "pp_project.hpp"
 
 #include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 
 /**
@@ -19,17 +26,31 @@ struct Config
     std::string mExecPath;
     std::string mImagePath;
     std::string mOutputRootPath;
-    float       mWidthMM;
-    float       mPrintAreaXMM;
-    float       mPrintAreaYMM;
+    float       mWidthMM = 0.f;
+    float       mPrintAreaXMM = 0.f;
+    float       mPrintAreaYMM = 0.f;
     bool        mToolRefilling = false;
     float       mToolWidthMM = 1.f;
     std::string mToolColor;
-    float       mToolDragErrorMM;
+    float       mToolDragErrorMM = 0.f;
     std::string mToolRefillCommandFilePath;
     float       mLengthBeforeRefillMM = 300.f;
+    bool        mHasRefillStation = false;
+    float       mRefillStationXMM = 0.f;
+    float       mRefillStationYMM = 0.f;
     int         mToolDryTimeSeconds = 20;
     std::vector<float> mLayersThresholds;
+    std::vector<PP::LayerMorph::FillMode> mLayersFillModes;
+    int         mNumThreads = PP::ThreadPool::getDefaultNumThreads();
+    float       mOrderingTimeBudgetMS = 0.f;
+    float       mSimplificationTolerance = 0.1f;
+    PP::CurveFitter::Mode mCurveFitting = PP::CurveFitter::eLines;
+    int         mGCodeDecimals = 3;
+    std::string mCacheDirectory;
+    std::string mBatchPath;
+    int         mNumConcurrentJobs = 4;
+    std::string mProfilePath;
+    std::string mTracePath;
 
     Config(int argc, char* argv[])
     {
@@ -145,12 +166,28 @@ struct Config
                     exit(EXIT_FAILURE);
                 }
             }
+            else if (std::string(argv[i]) == "-rs")
+            {
+                if (i + 2 < argc)
+                {
+                    mHasRefillStation = true;
+                    mRefillStationXMM = std::atof(argv[++i]);
+                    mRefillStationYMM = std::atof(argv[++i]);
+                }
+                else
+                {
+                    std::cerr << "-rs expects two values: x and y of the refill station in mm" << std::endl;
+                    std::cerr << usage() << std::flush;
+                    exit(EXIT_FAILURE);
+                }
+            }
             else if (std::string(argv[i]) == "-l")
             {
                 if (i + 1 < argc)
                 {
                     float lThreshold = std::atof(argv[++i]);
                     mLayersThresholds.push_back(lThreshold);
+                    mLayersFillModes.push_back(PP::LayerMorph::eHatchFill);
                 }
                 else
                 {
@@ -159,6 +196,151 @@ struct Config
                     exit(EXIT_FAILURE);
                 }
             }
+            else if (std::string(argv[i]) == "-lc")
+            {
+                if (i + 1 < argc)
+                {
+                    float lThreshold = std::atof(argv[++i]);
+                    mLayersThresholds.push_back(lThreshold);
+                    mLayersFillModes.push_back(PP::LayerMorph::eConcentricFill);
+                }
+                else
+                {
+                    std::cerr << "-lc expects a threshold value" << std::endl;
+                    std::cerr << usage() << std::flush;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (std::string(argv[i]) == "-j")
+            {
+                if (i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+                {
+                    mNumThreads = std::atoi(argv[++i]);
+                }
+                else
+                {
+                    std::cerr << "-j expects a number of threads" << std::endl;
+                    std::cerr << usage() << std::flush;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (std::string(argv[i]) == "-st")
+            {
+                if (i + 1 < argc && std::atof(argv[i + 1]) >= 0.f)
+                {
+                    mSimplificationTolerance = std::atof(argv[++i]);
+                }
+                else
+                {
+                    std::cerr << "-st expects a tolerance as a fraction of the tool width" << std::endl;
+                    std::cerr << usage() << std::flush;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (std::string(argv[i]) == "-cf")
+            {
+                if (i + 1 < argc && toCurveFitting(argv[i + 1], mCurveFitting))
+                {
+                    ++i;
+                }
+                else
+                {
+                    std::cerr << "-cf expects lines, arcs or cubics" << std::endl;
+                    std::cerr << usage() << std::flush;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (std::string(argv[i]) == "-ot")
+            {
+                if (i + 1 < argc && std::atof(argv[i + 1]) >= 0.f)
+                {
+                    mOrderingTimeBudgetMS = std::atof(argv[++i]);
+                }
+                else
+                {
+                    std::cerr << "-ot expects a time budget in milliseconds" << std::endl;
+                    std::cerr << usage() << std::flush;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (std::string(argv[i]) == "-gd")
+            {
+                if (i + 1 < argc && std::atoi(argv[i + 1]) >= 0 && std::atoi(argv[i + 1]) <= 6)
+                {
+                    mGCodeDecimals = std::atoi(argv[++i]);
+                }
+                else
+                {
+                    std::cerr << "-gd expects a number of decimals from 0 to 6" << std::endl;
+                    std::cerr << usage() << std::flush;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (std::string(argv[i]) == "-cd")
+            {
+                if (i + 1 < argc)
+                {
+                    mCacheDirectory = argv[++i];
+                }
+                else
+                {
+                    std::cerr << "-cd expects a cache directory" << std::endl;
+                    std::cerr << usage() << std::flush;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (std::string(argv[i]) == "--batch")
+            {
+                if (i + 1 < argc)
+                {
+                    mBatchPath = argv[++i];
+                }
+                else
+                {
+                    std::cerr << "--batch expects a job manifest" << std::endl;
+                    std::cerr << usage() << std::flush;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (std::string(argv[i]) == "--profile")
+            {
+                if (i + 1 < argc)
+                {
+                    mProfilePath = argv[++i];
+                }
+                else
+                {
+                    std::cerr << "--profile expects a JSON file path" << std::endl;
+                    std::cerr << usage() << std::flush;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (std::string(argv[i]) == "--trace")
+            {
+                if (i + 1 < argc)
+                {
+                    mTracePath = argv[++i];
+                }
+                else
+                {
+                    std::cerr << "--trace expects a JSON file path" << std::endl;
+                    std::cerr << usage() << std::flush;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else if (std::string(argv[i]) == "-bj")
+            {
+                if (i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+                {
+                    mNumConcurrentJobs = std::atoi(argv[++i]);
+                }
+                else
+                {
+                    std::cerr << "-bj expects a number of jobs" << std::endl;
+                    std::cerr << usage() << std::flush;
+                    exit(EXIT_FAILURE);
+                }
+            }
             else
             {
                 std::cerr << "Did not understand this argument: " << argv[i] << std::endl;
@@ -175,14 +357,217 @@ struct Config
                 + "Usage:\n"
                   "PaintPrint\n"
                   "      -i <image path>\n"
-                  "      -o <output gcode file root (without .gcode)>\n"
+                  "      -o <output gcode file root (without .gcode)>, - to stream the G-code to the standard output layer by layer, as it also is to <root>.gcode if it is a named pipe\n"
                   "      -ow <output image width in mm>\n"
                   "      -pa <print area x in mm> <print area y in mm>\n"
                   "   tool selection and configuration:\n"
                   "      -tnr <width in mm> <color> <drag error in mm> <dry time in seconds> for a tool that does not need to refill\n"
                   " [or] -tr <width in mm> <color> <drag error in mm> <refill command file> <length before refill in mm> <dry time in seconds> for a tool that needs refilling\n"
+                  "      -rs <x in mm> <y in mm> position of the refill station, defaults to where the refill command dips the tool\n"
                   "   passes/layers:\n"
-                  "      -l <threshold> add a layer, this argument can be used multiple times\n";
+                  "      -l <threshold> add a layer, this argument can be used multiple times\n"
+                  "      -lc <threshold> add a layer filled with concentric contours instead of hatches\n"
+                  "   strokes:\n"
+                  "      -st <tolerance as a fraction of the tool width> of the simplification of the strokes, 0 for none, defaults to 0.1\n"
+                  "      -cf <lines|arcs|cubics> fits the strokes with G1 only, G2/G3 arcs too, or G5 cubic curves too, within the simplification tolerance, defaults to lines\n"
+                  "      -ot <time budget in ms> spent shortening the travel of every refill batch, which makes the G-code depend on the speed of the machine, defaults to 0 for a fixed number of passes\n"
+                  "      -gd <number of decimals> of the coordinates in the G-code, at least 2 with arcs or cubics, defaults to 3\n"
+                  "   performance:\n"
+                  "      -j <number of threads> defaults to the number of cores\n"
+                  "      -cd <cache directory> where the traced layers are kept, so that compiling the same image again with other tool drag error, refill, dry time or print area only writes the G-code\n"
+                  "      --profile <out.json> writes the time spent in every stage, with the pixels, points, strokes, passes and G-code lines and bytes it processed, and the peak memory used\n"
+                  "      --trace <trace.json> writes the stages as trace events, to be viewed in chrome://tracing or Perfetto\n"
+                  "   batch:\n"
+                  "      --batch <manifest.json> compiles the jobs listed in the manifest, the other arguments being their defaults:\n"
+                  "         {\"jobs\": [{\"image\": \"a.jpg\", \"output\": \"a\", \"width\": 80, \"printArea\": [200, 200],\n"
+                  "                    \"tool\": {\"width\": 1.5, \"color\": \"#ddddfa\", \"dragError\": 2.5, \"dryTime\": 20,\n"
+                  "                             \"refillCommand\": \"refill.gcode\", \"lengthBeforeRefill\": 300, \"refillStation\": [0, 0]},\n"
+                  "                    \"layers\": [0.25, {\"threshold\": 0.45, \"fill\": \"concentric\"}],\n"
+                  "                    \"simplification\": 0.1, \"curveFitting\": \"arcs\", \"orderingTime\": 500, \"decimals\": 3, \"cache\": \"dir\"}, ...]}\n"
+                  "      -bj <number of jobs> compiled at once, bounding the memory used, defaults to 4\n";
+    }
+
+    /**
+     Overrides the arguments by the settings of a job of a batch manifest, the settings not given keeping their value.
+     A tool replaces the tool of the arguments, and layers their layers.
+     Returns false with pError set if a setting is not understood.
+     */
+    bool parseJob(const QJsonObject& pJob, std::string& pError)
+    {
+        for (auto lIt = pJob.begin() ; lIt != pJob.end() ; ++lIt)
+        {
+            const std::string lKey = lIt.key().toStdString();
+            const QJsonValue lValue = lIt.value();
+            if (lKey == "image" && lValue.isString())
+            {
+                mImagePath = lValue.toString().toStdString();
+            }
+            else if (lKey == "output" && lValue.isString())
+            {
+                mOutputRootPath = lValue.toString().toStdString();
+            }
+            else if (lKey == "width" && lValue.isDouble())
+            {
+                mWidthMM = lValue.toDouble();
+            }
+            else if (lKey == "printArea" && isPair(lValue))
+            {
+                mPrintAreaXMM = lValue.toArray()[0].toDouble();
+                mPrintAreaYMM = lValue.toArray()[1].toDouble();
+            }
+            else if (lKey == "tool" && lValue.isObject())
+            {
+                if (!parseTool(lValue.toObject(), pError))
+                {
+                    return false;
+                }
+            }
+            else if (lKey == "layers" && lValue.isArray())
+            {
+                if (!parseLayers(lValue.toArray(), pError))
+                {
+                    return false;
+                }
+            }
+            else if (lKey == "simplification" && lValue.toDouble(-1.) >= 0.)
+            {
+                mSimplificationTolerance = lValue.toDouble();
+            }
+            else if (lKey == "curveFitting" && lValue.isString())
+            {
+                if (!toCurveFitting(lValue.toString().toStdString(), mCurveFitting))
+                {
+                    pError = "curveFitting expects lines, arcs or cubics";
+                    return false;
+                }
+            }
+            else if (lKey == "orderingTime" && lValue.toDouble(-1.) >= 0.)
+            {
+                mOrderingTimeBudgetMS = lValue.toDouble();
+            }
+            else if (lKey == "decimals" && lValue.toInt(-1) >= 0 && lValue.toInt(-1) <= 6)
+            {
+                mGCodeDecimals = lValue.toInt();
+            }
+            else if (lKey == "cache" && lValue.isString())
+            {
+                mCacheDirectory = lValue.toString().toStdString();
+            }
+            else
+            {
+                pError = "Did not understand the job setting " + lKey;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool parseTool(const QJsonObject& pTool, std::string& pError)
+    {
+        mToolRefilling = pTool.contains("refillCommand");
+        mHasRefillStation = false;
+        for (auto lIt = pTool.begin() ; lIt != pTool.end() ; ++lIt)
+        {
+            const std::string lKey = lIt.key().toStdString();
+            const QJsonValue lValue = lIt.value();
+            if (lKey == "width" && lValue.isDouble())
+            {
+                mToolWidthMM = lValue.toDouble();
+            }
+            else if (lKey == "color" && lValue.isString())
+            {
+                mToolColor = lValue.toString().toStdString();
+            }
+            else if (lKey == "dragError" && lValue.isDouble())
+            {
+                mToolDragErrorMM = lValue.toDouble();
+            }
+            else if (lKey == "dryTime" && lValue.isDouble())
+            {
+                mToolDryTimeSeconds = lValue.toInt();
+            }
+            else if (lKey == "refillCommand" && lValue.isString())
+            {
+                mToolRefillCommandFilePath = lValue.toString().toStdString();
+            }
+            else if (lKey == "lengthBeforeRefill" && lValue.isDouble())
+            {
+                mLengthBeforeRefillMM = lValue.toDouble();
+            }
+            else if (lKey == "refillStation" && isPair(lValue))
+            {
+                mHasRefillStation = true;
+                mRefillStationXMM = lValue.toArray()[0].toDouble();
+                mRefillStationYMM = lValue.toArray()[1].toDouble();
+            }
+            else
+            {
+                pError = "Did not understand the tool setting " + lKey;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     Every layer is either a threshold, hatched, or an object with a threshold and a fill, hatch or concentric.
+     */
+    bool parseLayers(const QJsonArray& pLayers, std::string& pError)
+    {
+        mLayersThresholds.clear();
+        mLayersFillModes.clear();
+        for (const QJsonValue& lLayer : pLayers)
+        {
+            const QJsonValue lThreshold = lLayer.isObject() ? lLayer.toObject().value("threshold") : lLayer;
+            const std::string lFill = lLayer.isObject() ? lLayer.toObject().value("fill").toString().toStdString() : "";
+            if (!lThreshold.isDouble() || !(lFill.empty() || lFill == "hatch" || lFill == "concentric"))
+            {
+                pError = "A layer is a threshold, or an object with a threshold and a fill, hatch or concentric";
+                return false;
+            }
+            mLayersThresholds.push_back(lThreshold.toDouble());
+            mLayersFillModes.push_back((lFill == "concentric") ? PP::LayerMorph::eConcentricFill : PP::LayerMorph::eHatchFill);
+        }
+        return true;
+    }
+
+    static bool toCurveFitting(const std::string& pMode, PP::CurveFitter::Mode& pCurveFitting)
+    {
+        if (pMode != "lines" && pMode != "arcs" && pMode != "cubics")
+        {
+            return false;
+        }
+        pCurveFitting = (pMode == "lines") ? PP::CurveFitter::eLines
+                      : ((pMode == "arcs") ? PP::CurveFitter::eArcs : PP::CurveFitter::eArcsAndCubics);
+        return true;
+    }
+
+    static bool isPair(const QJsonValue& pValue)
+    {
+        return pValue.isArray() && pValue.toArray().size() == 2 && pValue.toArray()[0].isDouble() && pValue.toArray()[1].isDouble();
+    }
+
+    /**
+     Fewer decimals round the centres of the arcs and their end points apart by more than strict firmwares accept.
+     */
+    static const int cMinFittedDecimals = 2;
+
+    /**
+     Returns false with pError set if settings that are valid by themselves cannot be used together.
+     */
+    bool isConsistent(std::string& pError) const
+    {
+        if (mCurveFitting != PP::CurveFitter::eLines && mGCodeDecimals < cMinFittedDecimals)
+        {
+            pError = "Fitting arcs or cubics needs at least " + std::to_string(cMinFittedDecimals) + " decimals in the G-code";
+            return false;
+        }
+        if (PP::ThresholdBands::getCutoffs(mLayersThresholds).size() > PP::ThresholdBands::cMaxCutoffs)
+        {
+            pError = "At most " + std::to_string(PP::ThresholdBands::cMaxCutoffs) + " layers of different thresholds can be compiled at once";
+            return false;
+        }
+        return true;
     }
 
     bool isValid() const
@@ -195,71 +580,262 @@ struct Config
     }
 };
 
-int main(int argc, char *argv[])
+/**
+ Compiles the project described by pConfig, writing the messages to pLog.
+ Returns false with pError set if it failed.
+ */
+static bool runProject(const Config& pConfig, std::ostream& pLog, std::string& pError)
 {
-    //QCoreApplication a(argc, argv);
-
-    Config lConfig(argc, argv);
-
-    if (!lConfig.isValid())
+    PP::Project lProject;
+    if (!lProject.setImagePath(pConfig.mImagePath))
     {
-        std::clog << "Invalid arguments list" << std::endl;
-        std::clog << Config::usage() << std::flush;
-        return EXIT_FAILURE;
+        pError = "Could not load image " + pConfig.mImagePath;
+        return false;
     }
-
-    PP::Project lProject;
-    lProject.setImagePath(lConfig.mImagePath);
-    lProject.setSaveRoot(lConfig.mOutputRootPath);
-    lProject.setWidthMM(lConfig.mWidthMM);
-    lProject.setPrintArea(lConfig.mPrintAreaXMM, lConfig.mPrintAreaYMM);
-    QColor lColor(lConfig.mToolColor.c_str());
-    if (!lConfig.mToolRefilling)
+    lProject.setSaveRoot(pConfig.mOutputRootPath);
+    lProject.setWidthMM(pConfig.mWidthMM);
+    lProject.setPrintArea(pConfig.mPrintAreaXMM, pConfig.mPrintAreaYMM);
+    lProject.setOrderingTimeBudgetMS(pConfig.mOrderingTimeBudgetMS);
+    lProject.setSimplificationTolerance(pConfig.mSimplificationTolerance);
+    lProject.setCurveFitting(pConfig.mCurveFitting);
+    lProject.setGCodeDecimals(pConfig.mGCodeDecimals);
+    lProject.setCacheDirectory(pConfig.mCacheDirectory);
+    QColor lColor(pConfig.mToolColor.c_str());
+    if (!pConfig.mToolRefilling)
     {
         lProject.setTool(PP::Tool::noRefillTool("User tool",
-                                                lConfig.mToolWidthMM,
+                                                pConfig.mToolWidthMM,
                                                 lColor,
-                                                lConfig.mToolDragErrorMM,
-                                                lConfig.mToolDryTimeSeconds));
+                                                pConfig.mToolDragErrorMM,
+                                                pConfig.mToolDryTimeSeconds));
     }
     else
     {
         std::ifstream lFile;
-        lFile.open(lConfig.mToolRefillCommandFilePath);
+        lFile.open(pConfig.mToolRefillCommandFilePath);
         if (!lFile.is_open())
         {
-            std::clog << "Could not load file " << lConfig.mToolRefillCommandFilePath << std::endl;
-            return(EXIT_FAILURE);
+            pError = "Could not load file " + pConfig.mToolRefillCommandFilePath;
+            return false;
         }
         std::string lRefillCommand { std::istreambuf_iterator<char>(lFile), std::istreambuf_iterator<char>() };
         lFile.close();
         PP::Tool lTool = PP::Tool::refillingTool("User refilling tool",
-                                                 lConfig.mToolWidthMM,
+                                                 pConfig.mToolWidthMM,
                                                  lColor,
-                                                 lConfig.mToolDragErrorMM,
-                                                 lConfig.mLengthBeforeRefillMM,
+                                                 pConfig.mToolDragErrorMM,
+                                                 pConfig.mLengthBeforeRefillMM,
                                                  lRefillCommand,
-                                                 lConfig.mToolDryTimeSeconds);
+                                                 pConfig.mToolDryTimeSeconds);
+        if (pConfig.mHasRefillStation)
+        {
+            lTool.setRefillStation(pConfig.mRefillStationXMM, pConfig.mRefillStationYMM);
+        }
         lProject.setTool(lTool);
     }
-    for (float lThreshold : lConfig.mLayersThresholds)
+    for (size_t i = 0 ; i != pConfig.mLayersThresholds.size() ; ++i)
+    {
+        lProject.addLayer(pConfig.mLayersThresholds[i], pConfig.mLayersFillModes[i]);
+    }
+    // there is no root to save images to when the G-code is streamed to the standard output
+    const bool cStreaming = (pConfig.mOutputRootPath == "-");
+    if (!cStreaming)
+    {
+        PP::Profiler::Scope lScope("preview");
+        pLog << "Generating preview…" << std::endl;
+        lProject.updatePreview();
+        lProject.getPreview().save((lProject.getSaveRoot() + ".blended.jpg").c_str());
+        PP::ThreadPool::getInstance().parallelFor(0, lProject.getNumLayers(), [&](int i) {
+            QImage lLayerEssential = lProject.getLayerEssential(i).toImage();
+            std::string lSavePath = (std::ostringstream() << lProject.getSaveRoot() << ".layer" << i << ".png").str();
+            lLayerEssential.save(lSavePath.c_str());
+        });
+        pLog << "Done." << std::endl;
+    }
+
+    pLog << "Generating project…" << std::endl;
+    if (!lProject.compileProject())
+    {
+        pError = "Could not write G-code to " + (cStreaming ? std::string("the standard output") : lProject.getSaveRoot() + ".gcode");
+        return false;
+    }
+    const auto& lLayersStatistics = lProject.getLayersStatistics();
+    for (size_t i = 0 ; i != lLayersStatistics.size() ; ++i)
+    {
+        pLog << "Layer " << i + 1 << " travel: " << lLayersStatistics[i].mTravelBeforeMM << " mm before ordering, "
+             << lLayersStatistics[i].mTravelAfterMM << " mm after, " << lLayersStatistics[i].mNumRefills << " refills, "
+             << lLayersStatistics[i].mNumPointsTraced << " points simplified to "
+             << lLayersStatistics[i].mNumPointsSimplified << ", "
+             << lLayersStatistics[i].mNumLinearMoves << " moves fitted to " << lLayersStatistics[i].mNumFittedMoves
+             << " (compression ratio " << (float)lLayersStatistics[i].mNumLinearMoves / std::max(1, lLayersStatistics[i].mNumFittedMoves)
+             << ")" << std::endl;
+    }
+    pLog << "Done." << std::endl;
+    return true;
+}
+
+/**
+ Compiles the job pJob of a batch manifest, whose defaults are pDefaults.
+ */
+static bool runJob(const Config& pDefaults, const QJsonValue& pJob, std::ostream& pLog, std::string& pError)
+{
+    Config lConfig = pDefaults;
+    if (!pJob.isObject())
+    {
+        pError = "A job is an object";
+        return false;
+    }
+    if (!lConfig.parseJob(pJob.toObject(), pError) || !lConfig.isConsistent(pError))
+    {
+        return false;
+    }
+    if (!lConfig.isValid())
+    {
+        pError = "A job needs an image, an output, a width and a print area";
+        return false;
+    }
+    if (lConfig.mOutputRootPath == "-")
+    {
+        pError = "The G-code of a job cannot be streamed to the standard output";
+        return false;
+    }
+    try
+    {
+        return runProject(lConfig, pLog, pError);
+    }
+    catch (const std::exception& lException)
+    {
+        pError = lException.what();
+        return false;
+    }
+}
+
+/**
+ Compiles all the jobs of the manifest at pConfig.mBatchPath, then prints whether every one succeeded.
+ The jobs share the thread pool, pConfig.mNumConcurrentJobs of them being compiled at once so that the memory used is
+ bounded, the threads they leave idle taking the iterations of their parallel loops.
+ */
+static int runBatch(const Config& pConfig)
+{
+    QFile lFile(QString::fromStdString(pConfig.mBatchPath));
+    if (!lFile.open(QIODevice::ReadOnly))
+    {
+        std::clog << "Could not load file " << pConfig.mBatchPath << std::endl;
+        return EXIT_FAILURE;
+    }
+    QJsonParseError lParseError;
+    const QJsonDocument lManifest = QJsonDocument::fromJson(lFile.readAll(), &lParseError);
+    if (lParseError.error != QJsonParseError::NoError)
+    {
+        std::clog << "Could not parse " << pConfig.mBatchPath << " at offset " << lParseError.offset << ": "
+                  << lParseError.errorString().toStdString() << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!lManifest.isObject() || !lManifest.object().value("jobs").isArray())
     {
-        lProject.addLayer(lThreshold);
+        std::clog << "A job manifest is an object with an array of jobs" << std::endl;
+        return EXIT_FAILURE;
     }
-    std::cout << "Generating preview…" << std::endl;
-    lProject.updatePreview();
-    lProject.getPreview().save((lProject.getSaveRoot() + ".blended.jpg").c_str());
-    for (int i = 0 ; i != lProject.getNumLayers() ; ++i)
+
+    const QJsonArray lJobs = lManifest.object().value("jobs").toArray();
+    const int cNumJobs = lJobs.size();
+    std::vector<std::string> lErrors(cNumJobs);
+    std::vector<bool> lSucceeded(cNumJobs, false);
+    std::vector<double> lSeconds(cNumJobs, 0.);
+    std::atomic<int> lNext(0);
+    std::mutex lLogMutex;
+    PP::ThreadPool::getInstance().parallelFor(0, std::min(cNumJobs, pConfig.mNumConcurrentJobs), [&](int) {
+        for (int j = lNext++ ; j < cNumJobs ; j = lNext++)
+        {
+            // the messages of a job are printed together when it is done
+            std::ostringstream lLog;
+            const auto lStart = std::chrono::steady_clock::now();
+            lSucceeded[j] = runJob(pConfig, lJobs[j], lLog, lErrors[j]);
+            lSeconds[j] = std::chrono::duration<double>(std::chrono::steady_clock::now() - lStart).count();
+            std::lock_guard<std::mutex> lLock(lLogMutex);
+            std::cout << "Job " << j + 1 << "/" << cNumJobs << ":\n" << lLog.str() << std::flush;
+        }
+    });
+
+    int lNumFailed = 0;
+    std::cout << "Batch summary:" << std::endl;
+    for (int j = 0 ; j != cNumJobs ; ++j)
+    {
+        const QJsonValue lImage = lJobs[j].toObject().value("image");
+        std::cout << "  Job " << j + 1 << " (" << (lImage.isString() ? lImage.toString().toStdString() : (pConfig.mImagePath.empty() ? "no image" : pConfig.mImagePath)) << "): ";
+        if (lSucceeded[j])
+        {
+            std::cout << "succeeded in " << lSeconds[j] << " s" << std::endl;
+        }
+        else
+        {
+            std::cout << "failed: " << lErrors[j] << std::endl;
+            ++lNumFailed;
+        }
+    }
+    std::cout << cNumJobs - lNumFailed << " of " << cNumJobs << " jobs succeeded." << std::endl;
+    return (lNumFailed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ Writes the profile and the trace of the stages, if they were asked for.
+ */
+static int writeProfile(const Config& pConfig, int pExitCode)
+{
+    if (!pConfig.mProfilePath.empty() && !PP::Profiler::getInstance().writeProfile(pConfig.mProfilePath))
+    {
+        std::clog << "Could not write the profile to " << pConfig.mProfilePath << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!pConfig.mTracePath.empty() && !PP::Profiler::getInstance().writeTrace(pConfig.mTracePath))
+    {
+        std::clog << "Could not write the trace to " << pConfig.mTracePath << std::endl;
+        return EXIT_FAILURE;
+    }
+    return pExitCode;
+}
+
+int main(int argc, char *argv[])
+{
+    //QCoreApplication a(argc, argv);
+
+    Config lConfig(argc, argv);
+
+    if (!lConfig.mProfilePath.empty() || !lConfig.mTracePath.empty())
+    {
+        PP::Profiler::getInstance().start();
+    }
+
+    PP::ThreadPool::getInstance().setNumThreads(lConfig.mNumThreads);
+
+    if (!lConfig.mBatchPath.empty())
+    {
+        return writeProfile(lConfig, runBatch(lConfig));
+    }
+
+    if (!lConfig.isValid())
+    {
+        std::clog << "Invalid arguments list" << std::endl;
+        std::clog << Config::usage() << std::flush;
+        return EXIT_FAILURE;
+    }
+
+    std::string lError;
+    if (!lConfig.isConsistent(lError))
+    {
+        std::clog << lError << std::endl;
+        std::clog << Config::usage() << std::flush;
+        return EXIT_FAILURE;
+    }
+
+    // the G-code streamed to the standard output is not mixed with the messages
+    if (!runProject(lConfig, (lConfig.mOutputRootPath == "-") ? std::clog : std::cout, lError))
     {
-        QImage lLayerEssential = lProject.getLayerEssential(i).toImage();
-        std::string lSavePath = (std::ostringstream() << lProject.getSaveRoot() << ".layer" << i << ".png").str();
-        lLayerEssential.save(lSavePath.c_str());
+        std::clog << lError << std::endl;
+        return writeProfile(lConfig, EXIT_FAILURE);
     }
-    std::cout << "Done." << std::endl;
 
-    std::cout << "Generating project…" << std::endl;
-    lProject.compileProject();
-    std::cout << "Done." << std::endl;
+    return writeProfile(lConfig, EXIT_SUCCESS);
 
     //return a.exec();
 }
@@ -0,0 +1,332 @@
+#ifndef PP_CURVEFITTER_HPP_INCLUDED
+#define PP_CURVEFITTER_HPP_INCLUDED
+
+/**
+ @file      pp_curvefitter.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include "pp_utils.hpp"
+
+#include <cmath>
+#include <deque>
+#include <vector>
+
+namespace PP
+{
+
+/**
+ A move of the tool down, to mTo from the end of the previous one.
+ */
+struct FittedMove
+{
+    enum Type
+    {
+        eLine,                  ///< G1
+        eClockwiseArc,          ///< G2 around mCenter
+        eCounterClockwiseArc,   ///< G3 around mCenter
+        eCubic                  ///< G5 with the control points mControl1 and mControl2
+    };
+
+    Type mType;
+    PointMM mTo;
+    PointMM mCenter;
+    PointMM mControl1;
+    PointMM mControl2;
+};
+
+/**
+ Replaces the runs of points of a path that are within a tolerance of a circular arc, or of a cubic Bézier curve, by a
+ single move. From every point, the run is extended as long as it fits, and the longest fit wins over a line to the
+ next point.
+ */
+class CurveFitter
+{
+public:
+    enum Mode
+    {
+        eLines,         ///< G1 only, as traced
+        eArcs,          ///< G1, G2 and G3
+        eArcsAndCubics  ///< G1, G2, G3 and G5, for the firmwares that support it
+    };
+
+    CurveFitter(Mode pMode, float pToleranceMM)
+    : mMode(pMode)
+    , mToleranceMM(pToleranceMM)
+    {
+    }
+
+    Mode getMode() const
+    {
+        return mMode;
+    }
+
+    /**
+     The moves drawing pPoints from its first point.
+     */
+    std::vector<FittedMove> fit(const std::deque<PointMM>& pPoints) const
+    {
+        std::vector<FittedMove> lMoves;
+        size_t i = 0;
+        while (i + 1 < pPoints.size())
+        {
+            FittedMove lMove = {FittedMove::eLine, pPoints[i + 1], {0.f, 0.f}, {0.f, 0.f}, {0.f, 0.f}};
+            size_t lNext = i + 1;
+            if (mMode != eLines)
+            {
+                for (size_t j = i + 2 ; j < pPoints.size() && fitArc(pPoints, i, j, lMove) ; ++j)
+                {
+                    lNext = j;
+                }
+            }
+            if (mMode == eArcsAndCubics)
+            {
+                FittedMove lCubic = lMove;
+                size_t lCubicNext = lNext;
+                for (size_t j = i + 3 ; j < pPoints.size() && fitCubic(pPoints, i, j, lCubic) ; ++j)
+                {
+                    lCubicNext = j;
+                }
+                if (lCubicNext > lNext)
+                {
+                    lMove = lCubic;
+                    lNext = lCubicNext;
+                }
+            }
+            if (lMove.mType != FittedMove::eLine && isStraight(pPoints, i, lNext))
+            {
+                lMove.mType = FittedMove::eLine;
+            }
+            lMoves.push_back(lMove);
+            i = lNext;
+        }
+        return lMoves;
+    }
+
+    /**
+     Writes the path like CombinedPathMM::compile() does, with the fitted moves. Returns the number of moves the tool
+     makes down.
+     */
+    size_t compile(const CombinedPathMM& pPath, GCodeWriter& pOut) const
+    {
+        if (mMode == eLines)
+        {
+            pPath.compile(pOut);
+            return pPath.mPoints.size();
+        }
+        pOut.rapidZ(2.5f);
+        pOut.rapid(pPath.mPoints.front().mX, pPath.mPoints.front().mY);
+        pOut.rapidZ(0.f);
+        pOut.line(pPath.mPoints.front().mX, pPath.mPoints.front().mY);
+        const std::vector<FittedMove> lMoves = fit(pPath.mPoints);
+        PointMM lFrom = pPath.mPoints.front();
+        for (const FittedMove& lMove : lMoves)
+        {
+            switch (lMove.mType)
+            {
+                case FittedMove::eLine:
+                    pOut.line(lMove.mTo.mX, lMove.mTo.mY);
+                    break;
+                case FittedMove::eClockwiseArc:
+                case FittedMove::eCounterClockwiseArc:
+                    pOut.arc(lMove.mType == FittedMove::eClockwiseArc,
+                             lMove.mCenter.mX - lFrom.mX, lMove.mCenter.mY - lFrom.mY, lMove.mTo.mX, lMove.mTo.mY);
+                    break;
+                case FittedMove::eCubic:
+                    pOut.cubic(lMove.mControl1.mX - lFrom.mX, lMove.mControl1.mY - lFrom.mY,
+                               lMove.mControl2.mX - lMove.mTo.mX, lMove.mControl2.mY - lMove.mTo.mY,
+                               lMove.mTo.mX, lMove.mTo.mY);
+                    break;
+            }
+            lFrom = lMove.mTo;
+        }
+        pOut.rapidZ(2.5f);
+        return lMoves.size() + 1;
+    }
+
+private:
+    /**
+     Arcs flatter than this are left to lines, their centre being too far for the firmwares to be accurate.
+     */
+    static constexpr float cMaxRadiusMM = 1000.f;
+
+    static float getDistance(PointMM a, PointMM b)
+    {
+        return std::hypot(b.mX - a.mX, b.mY - a.mY);
+    }
+
+    /**
+     Whether the points pFirst to pLast are within the tolerance of the arc through the first, the middle and the last
+     one, turning the same way all along and less than a full turn, with every segment between two points within the
+     tolerance of the arc too.
+     */
+    bool fitArc(const std::deque<PointMM>& pPoints, size_t pFirst, size_t pLast, FittedMove& pMove) const
+    {
+        const PointMM a = pPoints[pFirst];
+        const PointMM b = pPoints[(pFirst + pLast) / 2];
+        const PointMM c = pPoints[pLast];
+        const float lDeterminant = 2.f * ((b.mX - a.mX) * (c.mY - a.mY) - (b.mY - a.mY) * (c.mX - a.mX));
+        if (std::fabs(lDeterminant) < 1e-9f)
+        {
+            return false;
+        }
+        const float lAB2 = (b.mX - a.mX) * (b.mX - a.mX) + (b.mY - a.mY) * (b.mY - a.mY);
+        const float lAC2 = (c.mX - a.mX) * (c.mX - a.mX) + (c.mY - a.mY) * (c.mY - a.mY);
+        const PointMM lCenter = {a.mX + ((c.mY - a.mY) * lAB2 - (b.mY - a.mY) * lAC2) / lDeterminant,
+                                 a.mY + ((b.mX - a.mX) * lAC2 - (c.mX - a.mX) * lAB2) / lDeterminant};
+        const float lRadius = getDistance(lCenter, a);
+        if (lRadius > cMaxRadiusMM)
+        {
+            return false;
+        }
+
+        const float lDirection = (lDeterminant > 0.f) ? 1.f : -1.f;
+        const float cPi = 3.14159265f;
+        float lSweep = 0.f;
+        float lPreviousAngle = std::atan2(a.mY - lCenter.mY, a.mX - lCenter.mX);
+        for (size_t k = pFirst + 1 ; k <= pLast ; ++k)
+        {
+            const PointMM p = pPoints[k];
+            if (std::fabs(getDistance(lCenter, p) - lRadius) > mToleranceMM)
+            {
+                return false;
+            }
+            const float lAngle = std::atan2(p.mY - lCenter.mY, p.mX - lCenter.mX);
+            float lStep = lAngle - lPreviousAngle;
+            lStep += (lStep > cPi) ? -2.f * cPi : ((lStep <= -cPi) ? 2.f * cPi : 0.f);
+            if (lStep * lDirection <= 0.f)
+            {
+                return false;
+            }
+            lSweep += std::fabs(lStep);
+            lPreviousAngle = lAngle;
+            // sagitta of the chord from the previous point
+            const float lHalfChord = getDistance(pPoints[k - 1], p) / 2.f;
+            if (lRadius - std::sqrt(std::max(0.f, lRadius * lRadius - lHalfChord * lHalfChord)) > mToleranceMM)
+            {
+                return false;
+            }
+        }
+        if (lSweep >= 2.f * cPi - 1e-3f)
+        {
+            return false;
+        }
+        pMove.mType = (lDirection > 0.f) ? FittedMove::eCounterClockwiseArc : FittedMove::eClockwiseArc;
+        pMove.mTo = c;
+        pMove.mCenter = lCenter;
+        return true;
+    }
+
+    /**
+     Whether the points pFirst to pLast are within the tolerance of the segment between the first and the last one.
+     */
+    bool isStraight(const std::deque<PointMM>& pPoints, size_t pFirst, size_t pLast) const
+    {
+        for (size_t k = pFirst + 1 ; k < pLast ; ++k)
+        {
+            if (CombinedPathMM::getSquaredDistanceToSegment(pPoints[k], pPoints[pFirst], pPoints[pLast]) > mToleranceMM * mToleranceMM)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static PointMM getBezierPoint(PointMM p0, PointMM p1, PointMM p2, PointMM p3, float t)
+    {
+        const float s = 1.f - t;
+        const float b0 = s * s * s;
+        const float b1 = 3.f * s * s * t;
+        const float b2 = 3.f * s * t * t;
+        const float b3 = t * t * t;
+        return {b0 * p0.mX + b1 * p1.mX + b2 * p2.mX + b3 * p3.mX, b0 * p0.mY + b1 * p1.mY + b2 * p2.mY + b3 * p3.mY};
+    }
+
+    /**
+     Whether the points pFirst to pLast are within the tolerance of the cubic curve between the first and the last one
+     whose tangents at its ends are those of the path, the lengths of the tangents being fitted by least squares on the
+     points placed by their distance along the path. The curve between two points must be within the tolerance of the
+     segment between them.
+     */
+    bool fitCubic(const std::deque<PointMM>& pPoints, size_t pFirst, size_t pLast, FittedMove& pMove) const
+    {
+        const PointMM p0 = pPoints[pFirst];
+        const PointMM p3 = pPoints[pLast];
+        const float lLength0 = getDistance(p0, pPoints[pFirst + 1]);
+        const float lLength3 = getDistance(p3, pPoints[pLast - 1]);
+        if (lLength0 == 0.f || lLength3 == 0.f)
+        {
+            return false;
+        }
+        const PointMM lTangent0 = {(pPoints[pFirst + 1].mX - p0.mX) / lLength0, (pPoints[pFirst + 1].mY - p0.mY) / lLength0};
+        const PointMM lTangent3 = {(pPoints[pLast - 1].mX - p3.mX) / lLength3, (pPoints[pLast - 1].mY - p3.mY) / lLength3};
+
+        std::vector<float> lParameters(1, 0.f);
+        for (size_t k = pFirst + 1 ; k <= pLast ; ++k)
+        {
+            lParameters.push_back(lParameters.back() + getDistance(pPoints[k - 1], pPoints[k]));
+        }
+        const float lTotal = lParameters.back();
+        for (float& t : lParameters)
+        {
+            t /= lTotal;
+        }
+
+        float c00 = 0.f, c01 = 0.f, c11 = 0.f, x0 = 0.f, x1 = 0.f;
+        for (size_t k = pFirst ; k <= pLast ; ++k)
+        {
+            const float t = lParameters[k - pFirst];
+            const float s = 1.f - t;
+            const PointMM a0 = {lTangent0.mX * 3.f * s * s * t, lTangent0.mY * 3.f * s * s * t};
+            const PointMM a1 = {lTangent3.mX * 3.f * s * t * t, lTangent3.mY * 3.f * s * t * t};
+            const PointMM lOnChord = getBezierPoint(p0, p0, p3, p3, t);
+            const PointMM lResidual = {pPoints[k].mX - lOnChord.mX, pPoints[k].mY - lOnChord.mY};
+            c00 += a0.mX * a0.mX + a0.mY * a0.mY;
+            c01 += a0.mX * a1.mX + a0.mY * a1.mY;
+            c11 += a1.mX * a1.mX + a1.mY * a1.mY;
+            x0 += lResidual.mX * a0.mX + lResidual.mY * a0.mY;
+            x1 += lResidual.mX * a1.mX + lResidual.mY * a1.mY;
+        }
+        const float lDeterminant = c00 * c11 - c01 * c01;
+        float lAlpha0 = (lDeterminant != 0.f) ? (x0 * c11 - x1 * c01) / lDeterminant : 0.f;
+        float lAlpha3 = (lDeterminant != 0.f) ? (c00 * x1 - c01 * x0) / lDeterminant : 0.f;
+        if (lAlpha0 <= 1e-6f || lAlpha3 <= 1e-6f)
+        {
+            lAlpha0 = lAlpha3 = getDistance(p0, p3) / 3.f;
+        }
+        const PointMM p1 = {p0.mX + lAlpha0 * lTangent0.mX, p0.mY + lAlpha0 * lTangent0.mY};
+        const PointMM p2 = {p3.mX + lAlpha3 * lTangent3.mX, p3.mY + lAlpha3 * lTangent3.mY};
+
+        const float lTolerance2 = mToleranceMM * mToleranceMM;
+        for (size_t k = pFirst ; k <= pLast ; ++k)
+        {
+            const float t = lParameters[k - pFirst];
+            const PointMM q = getBezierPoint(p0, p1, p2, p3, t);
+            if (CombinedPathMM::getSquaredDistanceToSegment(q, pPoints[k], pPoints[k]) > lTolerance2)
+            {
+                return false;
+            }
+            if (k != pLast)
+            {
+                const PointMM lMiddle = getBezierPoint(p0, p1, p2, p3, (t + lParameters[k + 1 - pFirst]) / 2.f);
+                if (CombinedPathMM::getSquaredDistanceToSegment(lMiddle, pPoints[k], pPoints[k + 1]) > lTolerance2)
+                {
+                    return false;
+                }
+            }
+        }
+        pMove.mType = FittedMove::eCubic;
+        pMove.mTo = p3;
+        pMove.mControl1 = p1;
+        pMove.mControl2 = p2;
+        return true;
+    }
+
+    const Mode mMode;
+    const float mToleranceMM;
+};
+
+}
+
+#endif
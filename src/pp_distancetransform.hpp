@@ -0,0 +1,152 @@
+#ifndef PP_DISTANCETRANSFORM_HPP_INCLUDED
+#define PP_DISTANCETRANSFORM_HPP_INCLUDED
+
+/**
+ @file      pp_distancetransform.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include "pp_packedbinaryimage.hpp"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace PP
+{
+
+namespace MorphOps
+{
+    /**
+     Lower envelope of the parabolas (q - pFrom)^2 + pValues[q - pFrom] for q in [pFrom, pFrom + pValues.size()),
+     evaluated at the positions [0, pNumOutputs).
+     */
+    static void lowerEnvelope(const std::vector<int>& pValues, int pFrom, int pNumOutputs, std::vector<int>& pOutput,
+                              std::vector<int>& pVertices, std::vector<double>& pBoundaries)
+    {
+        // http://cs.brown.edu/people/pfelzens/papers/dt-final.pdf
+        const int cNumValues = (int)pValues.size();
+        pVertices.resize(cNumValues);
+        pBoundaries.resize(cNumValues + 1);
+        auto lParabola = [&](int q) {
+            return (double)pValues[q - pFrom] + (double)q * q;
+        };
+
+        int k = 0;
+        pVertices[0] = pFrom;
+        pBoundaries[0] = -std::numeric_limits<double>::infinity();
+        pBoundaries[1] = std::numeric_limits<double>::infinity();
+        for (int q = pFrom + 1 ; q < pFrom + cNumValues ; ++q)
+        {
+            double s = (lParabola(q) - lParabola(pVertices[k])) / (2.0 * (q - pVertices[k]));
+            while (s <= pBoundaries[k])
+            {
+                --k;
+                s = (lParabola(q) - lParabola(pVertices[k])) / (2.0 * (q - pVertices[k]));
+            }
+            ++k;
+            pVertices[k] = q;
+            pBoundaries[k] = s;
+            pBoundaries[k + 1] = std::numeric_limits<double>::infinity();
+        }
+
+        k = 0;
+        for (int q = 0 ; q < pNumOutputs ; ++q)
+        {
+            while (pBoundaries[k + 1] < q)
+            {
+                ++k;
+            }
+            const int lDelta = q - pVertices[k];
+            pOutput[q] = lDelta * lDelta + pValues[pVertices[k] - pFrom];
+        }
+    }
+
+    /**
+     Exact squared euclidean distance of every pixel to the closest background pixel, the outside of the image being
+     background. Two separable passes, linear in the number of pixels. The result is stored row by row.
+     */
+    static std::vector<int> squaredDistanceTransform(const PackedBinaryImage& pImage)
+    {
+        const int cWidth = (int)pImage.getWidth();
+        const int cHeight = (int)pImage.getHeight();
+        std::vector<int> lDistances(cWidth * cHeight, 0);
+
+        // vertical distances
+        for (int x = 0 ; x < cWidth ; ++x)
+        {
+            int lDistance = 0;
+            for (int y = 0 ; y < cHeight ; ++y)
+            {
+                lDistance = pImage.getPixel(x, y) ? lDistance + 1 : 0;
+                lDistances[y * cWidth + x] = lDistance;
+            }
+            lDistance = 0;
+            for (int y = cHeight - 1 ; y >= 0 ; --y)
+            {
+                int& lPixel = lDistances[y * cWidth + x];
+                lDistance = (lPixel == 0) ? 0 : lDistance + 1;
+                lPixel = std::min(lPixel, lDistance) * std::min(lPixel, lDistance);
+            }
+        }
+
+        // horizontal pass on the squared vertical distances, with background columns at -1 and width
+        std::vector<int> lRow(cWidth + 2, 0);
+        std::vector<int> lOutput(cWidth);
+        std::vector<int> lVertices;
+        std::vector<double> lBoundaries;
+        for (int y = 0 ; y < cHeight ; ++y)
+        {
+            std::copy(lDistances.begin() + y * cWidth, lDistances.begin() + (y + 1) * cWidth, lRow.begin() + 1);
+            lowerEnvelope(lRow, -1, cWidth, lOutput, lVertices, lBoundaries);
+            std::copy(lOutput.begin(), lOutput.end(), lDistances.begin() + y * cWidth);
+        }
+
+        return lDistances;
+    }
+
+    /**
+     Concentric contours of an image: the borders of the level sets of the distance to the background taken every
+     pStepPixels, the contour 0 being the border of the image itself.
+     */
+    static PackedBinaryImage concentricContours(const PackedBinaryImage& pImage, int pStepPixels, int pFirstContour = 0)
+    {
+        const int cWidth = (int)pImage.getWidth();
+        const int cHeight = (int)pImage.getHeight();
+        const std::vector<int> lDistances = squaredDistanceTransform(pImage);
+
+        // index of the ring of every pixel, -1 for the background
+        std::vector<int> lRings(cWidth * cHeight, -1);
+        for (size_t u = 0 ; u != lDistances.size() ; ++u)
+        {
+            if (lDistances[u] != 0)
+            {
+                lRings[u] = (int)((std::sqrt((double)lDistances[u]) - 1.0) / pStepPixels);
+            }
+        }
+
+        PackedBinaryImage lContours(pImage.getWidth(), pImage.getHeight());
+        for (int y = 0 ; y < cHeight ; ++y)
+        {
+            for (int x = 0 ; x < cWidth ; ++x)
+            {
+                const int lRing = lRings[y * cWidth + x];
+                if (lRing >= pFirstContour
+                    && (x == 0 || y == 0 || x == cWidth - 1 || y == cHeight - 1
+                        || lRings[y * cWidth + x - 1] < lRing
+                        || lRings[y * cWidth + x + 1] < lRing
+                        || lRings[(y - 1) * cWidth + x] < lRing
+                        || lRings[(y + 1) * cWidth + x] < lRing))
+                {
+                    lContours.setPixel(x, y, true);
+                }
+            }
+        }
+        return lContours;
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef PP_ENDPOINTGRID_HPP_INCLUDED
+#define PP_ENDPOINTGRID_HPP_INCLUDED
+
+/**
+ @file      pp_endpointgrid.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include "pp_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace PP
+{
+
+/**
+ Uniform grid of the end points of numbered paths, to find the paths that can be joined to another one without
+ comparing all the pairs. With cells as large as the search radius, a query only visits the 3x3 cells around a point.
+ Points are compared on squared distances.
+ */
+class EndpointGrid
+{
+public:
+    /**
+     Grid covering the rectangle from pMin to pMax, in which all the inserted points must lie. The cells are made
+     larger when needed to keep their number reasonable.
+     */
+    EndpointGrid(float pCellSize, PointMM pMin, PointMM pMax)
+    : mMin(pMin)
+    {
+        const float cMaxCellsPerSide = 2048.f;
+        const float cExtent = std::max(pMax.mX - pMin.mX, pMax.mY - pMin.mY);
+        const float cCellSize = std::max(pCellSize, cExtent / cMaxCellsPerSide);
+        mInvCellSize = (cCellSize > 0.f) ? 1.f / cCellSize : 1.f;
+        mNumCellsX = (int)((pMax.mX - pMin.mX) * mInvCellSize) + 1;
+        mNumCellsY = (int)((pMax.mY - pMin.mY) * mInvCellSize) + 1;
+        mCells.resize((size_t)mNumCellsX * mNumCellsY);
+    }
+
+    void insert(int pId, PointMM pPoint)
+    {
+        getCell(pPoint).push_back({pId, pPoint});
+        ++mNumEntries;
+    }
+
+    /**
+     Removes one end point pPoint of the path pId, which must have been inserted.
+     */
+    void remove(int pId, PointMM pPoint)
+    {
+        std::vector<Entry>& lEntries = getCell(pPoint);
+        for (size_t u = 0 ; u != lEntries.size() ; ++u)
+        {
+            if (lEntries[u].mId == pId && !(lEntries[u].mPoint != pPoint))
+            {
+                lEntries[u] = lEntries.back();
+                lEntries.pop_back();
+                --mNumEntries;
+                return;
+            }
+        }
+        assert(false);
+    }
+
+    static bool areWithin(PointMM a, PointMM b, float pRadius)
+    {
+        const float dx = b.mX - a.mX;
+        const float dy = b.mY - a.mY;
+        return dx * dx + dy * dy < pRadius * pRadius;
+    }
+
+    /**
+     The smallest id greater than pAfter of the paths having an end point within pRadius of pA or of pB, -1 if there
+     is none.
+     */
+    int findFirst(PointMM pA, PointMM pB, float pRadius, int pAfter) const
+    {
+        int lFirst = std::numeric_limits<int>::max();
+        for (PointMM lPoint : {pA, pB})
+        {
+            const int lMinX = getColumn(lPoint.mX - pRadius);
+            const int lMaxX = getColumn(lPoint.mX + pRadius);
+            const int lMinY = getRow(lPoint.mY - pRadius);
+            const int lMaxY = getRow(lPoint.mY + pRadius);
+            for (int cy = lMinY ; cy <= lMaxY ; ++cy)
+            {
+                for (int cx = lMinX ; cx <= lMaxX ; ++cx)
+                {
+                    for (const Entry& lEntry : mCells[(size_t)cy * mNumCellsX + cx])
+                    {
+                        if (lEntry.mId > pAfter && lEntry.mId < lFirst && areWithin(lPoint, lEntry.mPoint, pRadius))
+                        {
+                            lFirst = lEntry.mId;
+                        }
+                    }
+                }
+            }
+        }
+        return (lFirst == std::numeric_limits<int>::max()) ? -1 : lFirst;
+    }
+
+    /**
+     The ids of the pCount points nearest to p, the nearest first, ties being broken by the smallest id. There are
+     fewer when the grid does not hold as many points.
+     The cells are visited ring by ring around p until enough points are closer than any point of the next ring.
+     */
+    void findNearest(PointMM p, size_t pCount, std::vector<int>& pIds) const
+    {
+        pIds.clear();
+        if (pCount == 0 || mNumEntries == 0)
+        {
+            return;
+        }
+        const float cCellSize = 1.f / mInvCellSize;
+        const int cx = getColumn(p.mX);
+        const int cy = getRow(p.mY);
+        std::vector<std::pair<float, int>> lCandidates;
+        for (int r = 0 ; ; ++r)
+        {
+            for (int y = std::max(0, cy - r) ; y <= std::min(mNumCellsY - 1, cy + r) ; ++y)
+            {
+                // whole rows at the top and bottom of the ring, only both ends of the others
+                const bool cIsEdgeRow = (y == cy - r || y == cy + r);
+                const int cStep = cIsEdgeRow ? 1 : 2 * r;
+                for (int x = cx - r ; x <= cx + r ; x += std::max(1, cStep))
+                {
+                    if (x < 0 || x >= mNumCellsX)
+                    {
+                        continue;
+                    }
+                    for (const Entry& lEntry : mCells[(size_t)y * mNumCellsX + x])
+                    {
+                        const float dx = lEntry.mPoint.mX - p.mX;
+                        const float dy = lEntry.mPoint.mY - p.mY;
+                        lCandidates.push_back(std::make_pair(dx * dx + dy * dy, lEntry.mId));
+                    }
+                }
+            }
+            // the points of the next rings are at least r cells away
+            const float cReach = r * cCellSize;
+            const bool cCoversGrid = cx - r <= 0 && cy - r <= 0 && cx + r >= mNumCellsX - 1 && cy + r >= mNumCellsY - 1;
+            if (cCoversGrid || (size_t)std::count_if(lCandidates.begin(), lCandidates.end(), [=](const std::pair<float, int>& c) {
+                    return c.first <= cReach * cReach;
+                }) >= pCount)
+            {
+                break;
+            }
+        }
+        const size_t cNumFound = std::min(pCount, lCandidates.size());
+        std::partial_sort(lCandidates.begin(), lCandidates.begin() + cNumFound, lCandidates.end());
+        for (size_t u = 0 ; u != cNumFound ; ++u)
+        {
+            pIds.push_back(lCandidates[u].second);
+        }
+    }
+
+private:
+    struct Entry
+    {
+        int mId;
+        PointMM mPoint;
+    };
+
+    int getColumn(float x) const
+    {
+        return std::min(mNumCellsX - 1, std::max(0, (int)std::floor((x - mMin.mX) * mInvCellSize)));
+    }
+
+    int getRow(float y) const
+    {
+        return std::min(mNumCellsY - 1, std::max(0, (int)std::floor((y - mMin.mY) * mInvCellSize)));
+    }
+
+    std::vector<Entry>& getCell(PointMM p)
+    {
+        return mCells[(size_t)getRow(p.mY) * mNumCellsX + getColumn(p.mX)];
+    }
+
+    PointMM mMin;
+    float mInvCellSize;
+    int mNumCellsX;
+    int mNumCellsY;
+    size_t mNumEntries = 0;
+    std::vector<std::vector<Entry>> mCells;
+};
+
+}
+
+#endif
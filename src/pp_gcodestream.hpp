@@ -0,0 +1,169 @@
+#ifndef PP_GCODESTREAM_HPP_INCLUDED
+#define PP_GCODESTREAM_HPP_INCLUDED
+
+/**
+ @file      pp_gcodestream.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include "pp_gcodewriter.hpp"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace PP
+{
+
+/**
+ G-code written to the standard output or to a named pipe as soon as it is ready, so that a print host can start
+ printing while the rest is computed.
+ The text is made of numbered sections, the header then the layers, which are filled concurrently but written in order:
+ the text of a section is written at once when all the sections before it are closed, and kept until then otherwise.
+ */
+class GCodeStream
+{
+public:
+    /**
+     Stream to the standard output if pPath is "-", or to the named pipe at pPath, which is waited for a reader.
+     */
+    explicit GCodeStream(const std::string& pPath)
+    {
+        if (pPath == "-")
+        {
+#if defined(_WIN32)
+            mFile = ::_fileno(stdout);
+            ::_setmode(mFile, _O_BINARY);
+#else
+            mFile = STDOUT_FILENO;
+#endif
+        }
+        else
+        {
+#if defined(_WIN32)
+            mFile = ::_open(pPath.c_str(), _O_WRONLY | _O_BINARY);
+#else
+            mFile = ::open(pPath.c_str(), O_WRONLY);
+#endif
+            mOwnsFile = true;
+        }
+        mGood = mFile >= 0;
+    }
+
+    ~GCodeStream()
+    {
+        if (mOwnsFile && mFile >= 0)
+        {
+#if defined(_WIN32)
+            ::_close(mFile);
+#else
+            ::close(mFile);
+#endif
+        }
+    }
+
+    GCodeStream(const GCodeStream&) = delete;
+    GCodeStream& operator=(const GCodeStream&) = delete;
+
+    /**
+     True if pPath names the standard output or a named pipe, which G-code is streamed to rather than written at once.
+     */
+    static bool isStream(const std::string& pPath)
+    {
+        if (pPath == "-")
+        {
+            return true;
+        }
+#if defined(_WIN32)
+        return false;
+#else
+        struct stat lStatus;
+        return ::stat(pPath.c_str(), &lStatus) == 0 && S_ISFIFO(lStatus.st_mode);
+#endif
+    }
+
+    /**
+     False if the stream could not be opened or a write failed.
+     */
+    bool isGood() const
+    {
+        std::lock_guard<std::mutex> lLock(mMutex);
+        return mGood;
+    }
+
+    /**
+     Adds pChunks at the end of the section pSection, which must not be closed.
+     */
+    void put(size_t pSection, std::vector<std::string>&& pChunks)
+    {
+        std::lock_guard<std::mutex> lLock(mMutex);
+        if (pSection == mCurrent)
+        {
+            writeChunks(pChunks);
+        }
+        else
+        {
+            std::vector<std::string>& lPending = mSections[pSection].mPending;
+            lPending.insert(lPending.end(), std::make_move_iterator(pChunks.begin()), std::make_move_iterator(pChunks.end()));
+        }
+    }
+
+    /**
+     Ends the section pSection, after which the following ones can be written.
+     */
+    void close(size_t pSection)
+    {
+        std::lock_guard<std::mutex> lLock(mMutex);
+        mSections[pSection].mClosed = true;
+        while (mSections.count(mCurrent) != 0 && mSections[mCurrent].mClosed)
+        {
+            mSections.erase(mCurrent);
+            ++mCurrent;
+            auto lNext = mSections.find(mCurrent);
+            if (lNext != mSections.end())
+            {
+                writeChunks(lNext->second.mPending);
+                lNext->second.mPending.clear();
+            }
+        }
+    }
+
+private:
+    struct Section
+    {
+        std::vector<std::string> mPending;
+        bool mClosed = false;
+    };
+
+    void writeChunks(const std::vector<std::string>& pChunks)
+    {
+        std::vector<const std::string*> lChunks;
+        for (const std::string& lChunk : pChunks)
+        {
+            lChunks.push_back(&lChunk);
+        }
+        mGood = mGood && GCodeWriter::writeChunks(mFile, lChunks);
+    }
+
+    mutable std::mutex mMutex;
+    int mFile = -1;
+    bool mOwnsFile = false;
+    bool mGood = false;
+    size_t mCurrent = 0;
+    std::map<size_t, Section> mSections;
+};
+
+}
+
+#endif
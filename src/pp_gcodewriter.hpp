@@ -0,0 +1,452 @@
+#ifndef PP_GCODEWRITER_HPP_INCLUDED
+#define PP_GCODEWRITER_HPP_INCLUDED
+
+/**
+ @file      pp_gcodewriter.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <functional>
+#if defined(_WIN32)
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <climits>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace PP
+{
+
+/**
+ G-code formatted into memory buffers, written to a file at once.
+ Numbers are written with a fixed number of decimals, and the axis words that would not change the position are
+ dropped, a move that would not change it at all being dropped too. The position is unknown at the start and after
+ raw commands.
+ The text is kept in chunks of about a megabyte, so that it never has to be moved to grow, that writers filled
+ concurrently are appended without a copy, and that the file is written with as few system calls as the platform
+ allows.
+ A writer given a sink hands it the text written so far on every flush(), to stream it.
+ */
+class GCodeWriter
+{
+public:
+    explicit GCodeWriter(int pDecimals = 3)
+    : mDecimals(pDecimals)
+    , mScale(std::pow(10.0, pDecimals))
+    {
+    }
+
+    int getDecimals() const
+    {
+        return mDecimals;
+    }
+
+    /**
+     Number of bytes written so far.
+     */
+    size_t getSize() const
+    {
+        size_t lSize = mBuffer.size();
+        for (const std::string& lChunk : mChunks)
+        {
+            lSize += lChunk.size();
+        }
+        return lSize;
+    }
+
+    /**
+     Function given the chunks written since the last flush().
+     */
+    void setSink(std::function<void(std::vector<std::string>&&)> pSink)
+    {
+        mSink = pSink;
+    }
+
+    /**
+     Hands the text written so far to the sink, if there is one.
+     */
+    void flush()
+    {
+        if (mSink)
+        {
+            mSink(takeChunks());
+        }
+    }
+
+    /**
+     Removes and returns the text written so far, the position being kept.
+     */
+    std::vector<std::string> takeChunks()
+    {
+        nextChunk();
+        std::vector<std::string> lChunks;
+        lChunks.swap(mChunks);
+        return lChunks;
+    }
+
+    void clear()
+    {
+        mChunks.clear();
+        mBuffer.clear();
+        forgetPosition();
+    }
+
+    /**
+     Sets the position the next moves are written from, as if it had been written.
+     */
+    void setPosition(float x, float y, float z)
+    {
+        mKnown[eX] = mKnown[eY] = mKnown[eZ] = true;
+        mPosition[eX] = toFixed(x);
+        mPosition[eY] = toFixed(y);
+        mPosition[eZ] = toFixed(z);
+    }
+
+    /**
+     A comment on its own line.
+     */
+    void comment(const std::string& pText)
+    {
+        mBuffer += '(';
+        mBuffer += pText;
+        mBuffer += ')';
+        endLine();
+    }
+
+    /**
+     Commands written as they are, after which the position is unknown.
+     */
+    void raw(const std::string& pCommands)
+    {
+        mBuffer += pCommands;
+        forgetPosition();
+        if (mBuffer.size() >= cChunkSize)
+        {
+            nextChunk();
+        }
+    }
+
+    /**
+     Appends what pOther wrote, which is moved and not copied, the position being the one pOther ends at.
+     */
+    void append(GCodeWriter&& pOther)
+    {
+        nextChunk();
+        pOther.nextChunk();
+        mChunks.insert(mChunks.end(), std::make_move_iterator(pOther.mChunks.begin()), std::make_move_iterator(pOther.mChunks.end()));
+        pOther.mChunks.clear();
+        for (int a = 0 ; a != eNumAxes ; ++a)
+        {
+            mKnown[a] = pOther.mKnown[a];
+            mPosition[a] = pOther.mPosition[a];
+        }
+    }
+
+    /**
+     Appends chunks of text written by another writer, after which the position is unknown.
+     */
+    void append(std::vector<std::string>&& pChunks)
+    {
+        nextChunk();
+        mChunks.insert(mChunks.end(), std::make_move_iterator(pChunks.begin()), std::make_move_iterator(pChunks.end()));
+        pChunks.clear();
+        forgetPosition();
+    }
+
+    void rapid(float x, float y)
+    {
+        move("G0", x, y);
+    }
+
+    void rapidZ(float z)
+    {
+        const int64_t lZ = toFixed(z);
+        if (isAt(eZ, lZ))
+        {
+            return;
+        }
+        mBuffer += "G0";
+        word('Z', eZ, lZ);
+        endLine();
+    }
+
+    void line(float x, float y)
+    {
+        move("G1", x, y);
+    }
+
+    /**
+     Arc to x, y around the centre at i, j from the current position.
+     */
+    void arc(bool pClockwise, float i, float j, float x, float y)
+    {
+        mBuffer += pClockwise ? "G2" : "G3";
+        number('I', toFixed(i));
+        number('J', toFixed(j));
+        axisWords(x, y);
+        endLine();
+    }
+
+    /**
+     Cubic curve to x, y whose control points are at i, j from the current position and at p, q from x, y.
+     */
+    void cubic(float i, float j, float p, float q, float x, float y)
+    {
+        mBuffer += "G5";
+        number('I', toFixed(i));
+        number('J', toFixed(j));
+        number('P', toFixed(p));
+        number('Q', toFixed(q));
+        axisWords(x, y);
+        endLine();
+    }
+
+    void dwell(int pMilliseconds)
+    {
+        mBuffer += "G4 P";
+        mBuffer += std::to_string(pMilliseconds);
+        endLine();
+    }
+
+    /**
+     Writes all the chunks to the file at pPath. Returns false if it could not be written.
+     */
+    bool write(const std::string& pPath) const
+    {
+#if defined(_WIN32)
+        const int lFile = ::_open(pPath.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        const int lFile = ::open(pPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+        if (lFile < 0)
+        {
+            return false;
+        }
+        const bool lWritten = writeChunks(lFile, getChunks());
+#if defined(_WIN32)
+        return (::_close(lFile) == 0) && lWritten;
+#else
+        return (::close(lFile) == 0) && lWritten;
+#endif
+    }
+
+    /**
+     Writes pChunks to the open file pFile with as few calls as the system allows, resuming after partial writes.
+     */
+    static bool writeChunks(int pFile, const std::vector<const std::string*>& pChunks)
+    {
+#if defined(_WIN32)
+        for (const std::string* lChunk : pChunks)
+        {
+            for (size_t lDone = 0 ; lDone != lChunk->size() ; )
+            {
+                const int lNumWritten = ::_write(pFile, lChunk->data() + lDone, (unsigned int)std::min<size_t>(lChunk->size() - lDone, 1 << 30));
+                if (lNumWritten < 0)
+                {
+                    return false;
+                }
+                lDone += lNumWritten;
+            }
+        }
+        return true;
+#else
+#if defined(IOV_MAX)
+        const size_t cMaxVectors = IOV_MAX;
+#else
+        const size_t cMaxVectors = 1024;
+#endif
+        std::vector<iovec> lVectors;
+        for (const std::string* lChunk : pChunks)
+        {
+            if (!lChunk->empty())
+            {
+                lVectors.push_back({const_cast<char*>(lChunk->data()), lChunk->size()});
+            }
+        }
+        size_t lFirst = 0;
+        while (lFirst != lVectors.size())
+        {
+            const ssize_t lNumWritten = ::writev(pFile, &lVectors[lFirst], (int)std::min(cMaxVectors, lVectors.size() - lFirst));
+            if (lNumWritten < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            size_t lRemaining = (size_t)lNumWritten;
+            while (lFirst != lVectors.size() && lRemaining >= lVectors[lFirst].iov_len)
+            {
+                lRemaining -= lVectors[lFirst].iov_len;
+                ++lFirst;
+            }
+            if (lRemaining != 0)
+            {
+                lVectors[lFirst].iov_base = (char*)lVectors[lFirst].iov_base + lRemaining;
+                lVectors[lFirst].iov_len -= lRemaining;
+            }
+        }
+        return true;
+#endif
+    }
+
+private:
+    /**
+     Size from which a buffer is set aside as a chunk and a new one started.
+     */
+    static constexpr size_t cChunkSize = 1 << 20;
+
+    void endLine()
+    {
+        mBuffer += '\n';
+        if (mBuffer.size() >= cChunkSize)
+        {
+            nextChunk();
+        }
+    }
+
+    void nextChunk()
+    {
+        if (!mBuffer.empty())
+        {
+            mChunks.push_back(std::string());
+            mChunks.back().swap(mBuffer);
+        }
+    }
+
+    std::vector<const std::string*> getChunks() const
+    {
+        std::vector<const std::string*> lChunks;
+        for (const std::string& lChunk : mChunks)
+        {
+            lChunks.push_back(&lChunk);
+        }
+        if (!mBuffer.empty())
+        {
+            lChunks.push_back(&mBuffer);
+        }
+        return lChunks;
+    }
+
+    enum Axis
+    {
+        eX,
+        eY,
+        eZ,
+        eNumAxes
+    };
+
+    void forgetPosition()
+    {
+        for (int a = 0 ; a != eNumAxes ; ++a)
+        {
+            mKnown[a] = false;
+        }
+    }
+
+    int64_t toFixed(float v) const
+    {
+        return (int64_t)std::llround(v * mScale);
+    }
+
+    bool isAt(Axis pAxis, int64_t pValue) const
+    {
+        return mKnown[pAxis] && mPosition[pAxis] == pValue;
+    }
+
+    void move(const char* pCommand, float x, float y)
+    {
+        const int64_t lX = toFixed(x);
+        const int64_t lY = toFixed(y);
+        if (isAt(eX, lX) && isAt(eY, lY))
+        {
+            return;
+        }
+        mBuffer += pCommand;
+        word('X', eX, lX);
+        word('Y', eY, lY);
+        endLine();
+    }
+
+    /**
+     The X and Y words of a move that must be written even if the position does not change.
+     */
+    void axisWords(float x, float y)
+    {
+        const int64_t lX = toFixed(x);
+        const int64_t lY = toFixed(y);
+        if (!isAt(eX, lX) || isAt(eY, lY))
+        {
+            number('X', lX);
+            mKnown[eX] = true;
+            mPosition[eX] = lX;
+        }
+        word('Y', eY, lY);
+    }
+
+    void word(char pLetter, Axis pAxis, int64_t pValue)
+    {
+        if (isAt(pAxis, pValue))
+        {
+            return;
+        }
+        number(pLetter, pValue);
+        mKnown[pAxis] = true;
+        mPosition[pAxis] = pValue;
+    }
+
+    /**
+     pLetter followed by the number whose fixed point representation is pValue, with all its decimals.
+     */
+    void number(char pLetter, int64_t pValue)
+    {
+        char lDigits[32];
+        int n = 0;
+        uint64_t lMagnitude = (pValue < 0) ? (uint64_t)(-pValue) : (uint64_t)pValue;
+        for (int d = 0 ; d < mDecimals || lMagnitude != 0 || d == mDecimals ; ++d)
+        {
+            if (d == mDecimals && mDecimals != 0)
+            {
+                lDigits[n++] = '.';
+            }
+            lDigits[n++] = (char)('0' + lMagnitude % 10);
+            lMagnitude /= 10;
+        }
+        mBuffer += ' ';
+        mBuffer += pLetter;
+        if (pValue < 0)
+        {
+            mBuffer += '-';
+        }
+        while (n != 0)
+        {
+            mBuffer += lDigits[--n];
+        }
+    }
+
+    const int mDecimals;
+    const double mScale;
+    std::vector<std::string> mChunks;
+    std::string mBuffer;
+    std::function<void(std::vector<std::string>&&)> mSink;
+    bool mKnown[eNumAxes] = {false, false, false};
+    int64_t mPosition[eNumAxes] = {0, 0, 0};
+};
+
+}
+
+#endif
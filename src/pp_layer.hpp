@@ -7,12 +7,28 @@
  @date      2017-2018
  */
 
+#include "pp_gcodewriter.hpp"
+#include "pp_thresholdbands.hpp"
 #include "pp_tool.hpp"
 
 #include <QImage>
 
 namespace PP
 {
+    /**
+     Figures reported by the compilation of a layer.
+     */
+    struct LayerStatistics
+    {
+        float mTravelBeforeMM = 0.f;    ///< pen-up travel, to and from the refill station, with the strokes in the order they were traced
+        float mTravelAfterMM = 0.f;     ///< the same once the strokes are ordered
+        int mNumRefills = 0;            ///< refills of the tool, including the first one
+        int mNumPointsTraced = 0;       ///< points of the strokes as traced
+        int mNumPointsSimplified = 0;   ///< points of the strokes once simplified
+        int mNumLinearMoves = 0;        ///< moves drawing the strokes with G1 only
+        int mNumFittedMoves = 0;        ///< moves drawing the strokes once fitted with curves
+    };
+
     class Layer
     {
     public:
@@ -20,9 +36,9 @@ namespace PP
 
         virtual ~Layer() {}
 
-        virtual void blendPreview(const QImage& pSrc, QImage& pBlendedImage, const Tool& pTool, float pWidthMM) const = 0;
+        virtual void blendPreview(const ThresholdBands& pSrc, QImage& pBlendedImage, const Tool& pTool, float pWidthMM) const = 0;
 
-        virtual void compile(QImage pImage, float pZoneSizeMMX, float pZoneSizeMMY, float pWidthMM, const Tool& pTool, std::ofstream& pOut) const = 0;
+        virtual void compile(const ThresholdBands& pImage, float pZoneSizeMMX, float pZoneSizeMMY, float pWidthMM, const Tool& pTool, GCodeWriter& pOut, LayerStatistics& pStatistics) const = 0;
     };
 }
 
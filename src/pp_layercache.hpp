@@ -0,0 +1,274 @@
+#ifndef PP_LAYERCACHE_HPP_INCLUDED
+#define PP_LAYERCACHE_HPP_INCLUDED
+
+/**
+ @file      pp_layercache.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include "pp_packedbinaryimage.hpp"
+#include "pp_utils.hpp"
+
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace PP
+{
+
+/**
+ On-disk cache of the results of the costly stages of the compilation of a layer, so that a project compiled again with
+ only machine-side parameters changed (drag error, refill command, dry time, print area) only emits its G-code again.
+ Every result is stored in its own file, named after a hash of everything it depends on: the essential image after the
+ pixels of the mask of the layer and the parameters of the morphological operators, the traced paths after the key of
+ the essential image and the parameters of the re-combination.
+ Files are written atomically, so that concurrent compilations can share a directory, and mapped to be read. A file
+ that cannot be read or written is a cache miss, never an error.
+ */
+class LayerCache
+{
+public:
+    /**
+     64-bit FNV-1a hash of the bytes of everything a result depends on.
+     */
+    class Key
+    {
+    public:
+        Key& add(const void* pData, size_t pSize)
+        {
+            const unsigned char* lBytes = static_cast<const unsigned char*>(pData);
+            for (size_t u = 0 ; u != pSize ; ++u)
+            {
+                mHash = (mHash ^ lBytes[u]) * 1099511628211ull;
+            }
+            return *this;
+        }
+
+        template <typename T>
+        Key& add(const T& pValue)
+        {
+            return add(&pValue, sizeof(T));
+        }
+
+        /**
+         Adds the size and the pixels of pMask, the bits beyond the width being ignored.
+         */
+        Key& add(const PackedBinaryImage& pMask)
+        {
+            add((uint64_t)pMask.getWidth());
+            add((uint64_t)pMask.getHeight());
+            const size_t cNumWords = pMask.getWordsPerRow();
+            for (size_t y = 0 ; cNumWords != 0 && y != pMask.getHeight() ; ++y)
+            {
+                const PackedBinaryImage::Word* lRow = pMask.getRow(y);
+                add(lRow, (cNumWords - 1) * sizeof(PackedBinaryImage::Word));
+                add((PackedBinaryImage::Word)(lRow[cNumWords - 1] & pMask.getLastWordMask()));
+            }
+            return *this;
+        }
+
+        std::string toString() const
+        {
+            char lHex[17];
+            std::snprintf(lHex, sizeof(lHex), "%016llx", (unsigned long long)mHash);
+            return lHex;
+        }
+
+    private:
+        uint64_t mHash = 14695981039346656037ull ^ cFormatVersion;
+    };
+
+    explicit LayerCache(const std::string& pDirectory)
+    : mDirectory(pDirectory)
+    {
+    }
+
+    bool load(const Key& pKey, BinaryImage& pEssential) const
+    {
+        MappedFile lFile(getPath(pKey, "essential"));
+        const uchar* lData = lFile.getData();
+        uint32_t lHeader[3];
+        if (lData == nullptr || lFile.getSize() < sizeof(lHeader))
+        {
+            return false;
+        }
+        std::memcpy(lHeader, lData, sizeof(lHeader));
+        const size_t cWidth = lHeader[1];
+        const size_t cHeight = lHeader[2];
+        if (lHeader[0] != cEssentialMagic || lFile.getSize() != sizeof(lHeader) + (cWidth * cHeight + 7) / 8)
+        {
+            return false;
+        }
+        const uchar* lBits = lData + sizeof(lHeader);
+        BinaryImage lEssential(cWidth, cHeight, false);
+        for (size_t y = 0 ; y != cHeight ; ++y)
+        {
+            for (size_t x = 0 ; x != cWidth ; ++x)
+            {
+                const size_t cBit = y * cWidth + x;
+                lEssential.getPixel(x, y) = ((lBits[cBit / 8] >> (cBit % 8)) & 1) != 0;
+            }
+        }
+        pEssential = lEssential;
+        return true;
+    }
+
+    void store(const Key& pKey, const BinaryImage& pEssential) const
+    {
+        const uint32_t lHeader[3] = {cEssentialMagic, (uint32_t)pEssential.getWidth(), (uint32_t)pEssential.getHeight()};
+        std::string lBytes(sizeof(lHeader) + (pEssential.getWidth() * pEssential.getHeight() + 7) / 8, '\0');
+        std::memcpy(&lBytes[0], lHeader, sizeof(lHeader));
+        for (size_t y = 0 ; y != pEssential.getHeight() ; ++y)
+        {
+            for (size_t x = 0 ; x != pEssential.getWidth() ; ++x)
+            {
+                const size_t cBit = y * pEssential.getWidth() + x;
+                lBytes[sizeof(lHeader) + cBit / 8] |= (char)((pEssential.getPixel(x, y) ? 1 : 0) << (cBit % 8));
+            }
+        }
+        write(getPath(pKey, "essential"), lBytes);
+    }
+
+    bool load(const Key& pKey, std::vector<CombinedPathMM>& pPaths) const
+    {
+        MappedFile lFile(getPath(pKey, "paths"));
+        const uchar* lData = lFile.getData();
+        uint32_t lHeader[3];
+        if (lData == nullptr || lFile.getSize() < sizeof(lHeader))
+        {
+            return false;
+        }
+        std::memcpy(lHeader, lData, sizeof(lHeader));
+        const size_t cNumPaths = lHeader[1];
+        const size_t cNumPoints = lHeader[2];
+        if (lHeader[0] != cPathsMagic || lFile.getSize() != sizeof(lHeader) + cNumPaths * sizeof(uint32_t) + cNumPoints * sizeof(PointMM))
+        {
+            return false;
+        }
+        std::vector<uint32_t> lSizes(cNumPaths);
+        std::memcpy(lSizes.data(), lData + sizeof(lHeader), cNumPaths * sizeof(uint32_t));
+        const uchar* lPoints = lData + sizeof(lHeader) + cNumPaths * sizeof(uint32_t);
+        size_t lNumRead = 0;
+        std::vector<CombinedPathMM> lPaths(cNumPaths);
+        for (size_t u = 0 ; u != cNumPaths ; ++u)
+        {
+            if (lSizes[u] == 0 || lSizes[u] > cNumPoints - lNumRead)
+            {
+                return false;
+            }
+            for (uint32_t i = 0 ; i != lSizes[u] ; ++i)
+            {
+                PointMM lPoint;
+                std::memcpy(&lPoint, lPoints + (lNumRead++) * sizeof(PointMM), sizeof(PointMM));
+                lPaths[u].mPoints.push_back(lPoint);
+            }
+        }
+        if (lNumRead != cNumPoints)
+        {
+            return false;
+        }
+        pPaths.swap(lPaths);
+        return true;
+    }
+
+    void store(const Key& pKey, const std::vector<CombinedPathMM>& pPaths) const
+    {
+        std::vector<uint32_t> lSizes;
+        size_t lNumPoints = 0;
+        for (const CombinedPathMM& lPath : pPaths)
+        {
+            lSizes.push_back((uint32_t)lPath.mPoints.size());
+            lNumPoints += lPath.mPoints.size();
+        }
+        const uint32_t lHeader[3] = {cPathsMagic, (uint32_t)pPaths.size(), (uint32_t)lNumPoints};
+        std::string lBytes;
+        lBytes.reserve(sizeof(lHeader) + lSizes.size() * sizeof(uint32_t) + lNumPoints * sizeof(PointMM));
+        lBytes.append(reinterpret_cast<const char*>(lHeader), sizeof(lHeader));
+        lBytes.append(reinterpret_cast<const char*>(lSizes.data()), lSizes.size() * sizeof(uint32_t));
+        for (const CombinedPathMM& lPath : pPaths)
+        {
+            for (const PointMM& lPoint : lPath.mPoints)
+            {
+                lBytes.append(reinterpret_cast<const char*>(&lPoint), sizeof(PointMM));
+            }
+        }
+        write(getPath(pKey, "paths"), lBytes);
+    }
+
+private:
+    /**
+     Changed with the format of the files or with the computations whose results they hold, so that older files are
+     not found anymore.
+     */
+    static const uint64_t cFormatVersion = 1;
+    static const uint32_t cEssentialMagic = 0x31455050; // "PPE1"
+    static const uint32_t cPathsMagic = 0x31505050;     // "PPP1"
+
+    /**
+     File mapped in memory, null if it cannot be opened.
+     */
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::string& pPath)
+        : mFile(QString::fromStdString(pPath))
+        {
+            if (mFile.open(QIODevice::ReadOnly) && mFile.size() > 0)
+            {
+                mSize = (size_t)mFile.size();
+                mData = mFile.map(0, mFile.size());
+            }
+        }
+
+        ~MappedFile()
+        {
+            if (mData != nullptr)
+            {
+                mFile.unmap(mData);
+            }
+        }
+
+        const uchar* getData() const
+        {
+            return mData;
+        }
+
+        size_t getSize() const
+        {
+            return mSize;
+        }
+
+    private:
+        QFile mFile;
+        uchar* mData = nullptr;
+        size_t mSize = 0;
+    };
+
+    std::string getPath(const Key& pKey, const char* pExtension) const
+    {
+        return mDirectory + "/" + pKey.toString() + "." + pExtension;
+    }
+
+    void write(const std::string& pPath, const std::string& pBytes) const
+    {
+        QDir().mkpath(QString::fromStdString(mDirectory));
+        QSaveFile lFile(QString::fromStdString(pPath));
+        if (lFile.open(QIODevice::WriteOnly) && lFile.write(pBytes.data(), (qint64)pBytes.size()) == (qint64)pBytes.size())
+        {
+            lFile.commit();
+        }
+    }
+
+    std::string mDirectory;
+};
+
+}
+
+#endif
@@ -7,6 +7,7 @@
  @date      2017-2018
  */
 
+#include "pp_endpointgrid.hpp"
 #include "pp_layer.hpp"
 #include "pp_utils.hpp"
 
@@ -37,7 +38,7 @@ public:
         mThreshold = pThreshold;
     }
     
-    void blendPreview(const QImage& pSrc, QImage& pBlendedImage, const Tool& pTool, float pWidthMM) const override
+    void blendPreview(const ThresholdBands& pSrc, QImage& pBlendedImage, const Tool& pTool, float pWidthMM) const override
     {
         jassert(pBlendedImage.getBounds() == pSrc.getBounds());
         
@@ -55,7 +56,7 @@ public:
         }
     }
     
-    void compile(QImage pImage, float pZoneSizeMMX, float pZoneSizeMMY, float pWidthMM, const Tool& pTool, std::ofstream& pOut) const override
+    void compile(const ThresholdBands& pImage, float pZoneSizeMMX, float pZoneSizeMMY, float pWidthMM, const Tool& pTool, GCodeWriter& pOut, LayerStatistics& pStatistics) const override
     {
         // width of the tool in pixels
         const int cStepPixels = std::max(1, (int)std::floor(pTool.getWidthMM() * pImage.getWidth() / pWidthMM));
@@ -129,13 +130,14 @@ public:
         // convert lines to physical coordinates
         struct SegmentMMCompiler
         {
-            static void compile (std::ofstream& pOut, const SegmentMM& pLinePathMM)
+            static void compile (GCodeWriter& pOut, const SegmentMM& pLinePathMM)
             {
-                //pOut << "G0 Z3" << std::endl;
-                pOut << "G0 X" << pLinePathMM.mFrom.mX << " Y" << pLinePathMM.mFrom.mY << " Z2.5" << std::endl;
-                pOut << "G0 Z0" << std::endl;
-                pOut << "G1 X" << pLinePathMM.mTo.mX << " Y" << pLinePathMM.mTo.mY << std::endl;
-                pOut << "G0 Z2.5" << std::endl;
+                //pOut.rapidZ(3.f);
+                pOut.rapidZ(2.5f);
+                pOut.rapid(pLinePathMM.mFrom.mX, pLinePathMM.mFrom.mY);
+                pOut.rapidZ(0.f);
+                pOut.line(pLinePathMM.mTo.mX, pLinePathMM.mTo.mY);
+                pOut.rapidZ(2.5f);
             }
         };
         std::vector<SegmentMM> lSegmentsMM;
@@ -152,60 +154,80 @@ public:
         }
         
 #if 1
-        // combine paths
+        // combine paths, the end points of the segments being indexed by a grid
+        //const float cSpacingTolerance = 1.45f * pTool.getWidthMM();
+        const float cSpacingTolerance = 2.15f * pTool.getWidthMM();
+        const int cNumSegments = (int)lSegmentsMM.size();
+        PointMM lMin = {0.f, 0.f};
+        PointMM lMax = {pZoneSizeMMX, pZoneSizeMMY};
+        for (const auto& lSegment : lSegmentsMM)
+        {
+            for (const PointMM& p : {lSegment.mFrom, lSegment.mTo})
+            {
+                lMin = {std::min(lMin.mX, p.mX), std::min(lMin.mY, p.mY)};
+                lMax = {std::max(lMax.mX, p.mX), std::max(lMax.mY, p.mY)};
+            }
+        }
+        EndpointGrid lEndpoints(cSpacingTolerance, lMin, lMax);
+        for (int s = 0 ; s != cNumSegments ; ++s)
+        {
+            lEndpoints.insert(s, lSegmentsMM[s].mFrom);
+            lEndpoints.insert(s, lSegmentsMM[s].mTo);
+        }
+        std::vector<bool> lTaken(cNumSegments, false);
         std::vector<CombinedPathMM> lCombinedPathMM;
-        auto lSegmentIt = std::begin(lSegmentsMM);
-        while (lSegmentIt != std::end(lSegmentsMM))
+        for (int s = 0 ; s != cNumSegments ; ++s)
         {
-            //const float cSpacingTolerance = 1.45f * pTool.getWidthMM();
-            const float cSpacingTolerance = 2.15f * pTool.getWidthMM();
-            float lLength = lSegmentIt->length();
-            CombinedPathMM lCombinedPath({lSegmentIt->mFrom, lSegmentIt->mTo});
-            // find a path that begins or ends with one end close to the begin or end of this one.
-            auto lIt = lSegmentIt;
-            ++lIt;
-            while (lIt != std::end(lSegmentsMM) && lLength < pTool.getLengthBeforeRefillMM())
+            if (lTaken[s])
+            {
+                continue;
+            }
+            const SegmentMM& lSegment = lSegmentsMM[s];
+            lEndpoints.remove(s, lSegment.mFrom);
+            lEndpoints.remove(s, lSegment.mTo);
+            float lLength = lSegment.length();
+            CombinedPathMM lCombinedPath({lSegment.mFrom, lSegment.mTo});
+            // find a segment that has one end close to the begin or end of this path.
+            int lPosition = s;
+            while (lLength < pTool.getLengthBeforeRefillMM())
             {
-                if (PointMM::length(lCombinedPath.mPoints.back(), lIt->mFrom) < cSpacingTolerance)
+                lPosition = lEndpoints.findFirst(lCombinedPath.mPoints.back(), lCombinedPath.mPoints.front(), cSpacingTolerance, lPosition);
+                if (lPosition < 0)
                 {
-                    lCombinedPath.mPoints.push_back(lIt->mFrom);
-                    lCombinedPath.mPoints.push_back(lIt->mTo);
-                    lLength += lIt->length() + cSpacingTolerance;
-                    lIt = lSegmentsMM.erase(lIt);
+                    break;
                 }
-                else if (PointMM::length(lCombinedPath.mPoints.back(), lIt->mTo) < cSpacingTolerance)
+                const SegmentMM& lOther = lSegmentsMM[lPosition];
+                lEndpoints.remove(lPosition, lOther.mFrom);
+                lEndpoints.remove(lPosition, lOther.mTo);
+                lTaken[lPosition] = true;
+                if (EndpointGrid::areWithin(lCombinedPath.mPoints.back(), lOther.mFrom, cSpacingTolerance))
                 {
-                    lCombinedPath.mPoints.push_back(lIt->mTo);
-                    lCombinedPath.mPoints.push_back(lIt->mFrom);
-                    lLength += lIt->length() + cSpacingTolerance;
-                    lIt = lSegmentsMM.erase(lIt);
+                    lCombinedPath.mPoints.push_back(lOther.mFrom);
+                    lCombinedPath.mPoints.push_back(lOther.mTo);
                 }
-                else if (PointMM::length(lCombinedPath.mPoints.front(), lIt->mFrom) < cSpacingTolerance)
+                else if (EndpointGrid::areWithin(lCombinedPath.mPoints.back(), lOther.mTo, cSpacingTolerance))
                 {
-                    lCombinedPath.mPoints.push_front(lIt->mFrom);
-                    lCombinedPath.mPoints.push_front(lIt->mTo);
-                    lLength += lIt->length() + cSpacingTolerance;
-                    lIt = lSegmentsMM.erase(lIt);
+                    lCombinedPath.mPoints.push_back(lOther.mTo);
+                    lCombinedPath.mPoints.push_back(lOther.mFrom);
                 }
-                else if (PointMM::length(lCombinedPath.mPoints.front(), lIt->mTo) < cSpacingTolerance)
+                else if (EndpointGrid::areWithin(lCombinedPath.mPoints.front(), lOther.mFrom, cSpacingTolerance))
                 {
-                    lCombinedPath.mPoints.push_front(lIt->mTo);
-                    lCombinedPath.mPoints.push_front(lIt->mFrom);
-                    lLength += lIt->length() + cSpacingTolerance;
-                    lIt = lSegmentsMM.erase(lIt);
+                    lCombinedPath.mPoints.push_front(lOther.mFrom);
+                    lCombinedPath.mPoints.push_front(lOther.mTo);
                 }
                 else
                 {
-                    ++lIt;
+                    lCombinedPath.mPoints.push_front(lOther.mTo);
+                    lCombinedPath.mPoints.push_front(lOther.mFrom);
                 }
+                lLength += lOther.length() + cSpacingTolerance;
             }
             lCombinedPathMM.push_back(lCombinedPath);
-            ++lSegmentIt;
         }
         
         // Convert to gcode
         float lLength = 0.f;
-        pOut << pTool.getReloadCommand();
+        pOut.raw(pTool.getReloadCommand());
         for (auto lPath : lCombinedPathMM)
         {
             lPath.compile(pOut);
@@ -213,14 +235,14 @@ public:
             lLength += 10.f; // each one spills some ink
             if (lLength > pTool.getLengthBeforeRefillMM())
             {
-                pOut << pTool.getReloadCommand();
+                pOut.raw(pTool.getReloadCommand());
                 lLength = 0.f;
             }
         }
 #else
         // Convert to gcode
         float lLength = 0.f;
-        pOut << pReloadCommand;
+        pOut.raw(pReloadCommand);
         for (auto lSegment : lSegmentsMM)
         {
             SegmentMMCompiler::compile(pOut, lSegment);
@@ -228,14 +250,14 @@ public:
             lLength += 10.f; // each one spills some ink
             if (lLength > pTool.getLengthBeforeRefillMM())
             {
-                pOut << pReloadCommand;
+                pOut.raw(pReloadCommand);
                 lLength = 0.f;
             }
         }
 #endif
         
         // Wait to dry
-        pOut << "G4 P" << pTool.getDryTimeSeconds() << "000" << std::endl;
+        pOut.dwell(pTool.getDryTimeSeconds() * 1000);
     }
     
 private:
@@ -7,9 +7,27 @@
  @date      2017-2018
  */
 
+#include "pp_curvefitter.hpp"
+#include "pp_distancetransform.hpp"
+#include "pp_endpointgrid.hpp"
 #include "pp_layer.hpp"
+#include "pp_layercache.hpp"
+#include "pp_packedbinaryimage.hpp"
+#include "pp_profiler.hpp"
+#include "pp_refillscheduler.hpp"
+#include "pp_skeletontracer.hpp"
+#include "pp_stage.hpp"
+#include "pp_structuringelement.hpp"
+#include "pp_threadpool.hpp"
+#include "pp_thresholdbands.hpp"
 #include "pp_utils.hpp"
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
 namespace PP
 {
 
@@ -18,15 +36,30 @@ class LayerMorph
 : public Layer
 {
 public:
-    LayerMorph(float pThreshold)
+    enum FillMode
+    {
+        eHatchFill,         ///< contour and diagonal hatching
+        eConcentricFill     ///< concentric contours
+    };
+    
+    LayerMorph(float pThreshold, FillMode pFillMode = eHatchFill)
     : Layer()
     , mThreshold(pThreshold)
+    , mFillMode(pFillMode)
     {
     }
     
     ~LayerMorph()
     {
     }
+
+    /**
+     A copy computes its stages again, while a layer moved when the layers of a project are reallocated keeps them.
+     */
+    LayerMorph(const LayerMorph&) = default;
+    LayerMorph(LayerMorph&&) = default;
+    LayerMorph& operator =(const LayerMorph&) = default;
+    LayerMorph& operator =(LayerMorph&&) = default;
     
     float getThreshold() const
     {
@@ -36,14 +69,103 @@ public:
     void setThreshold(float pThreshold)
     {
         mThreshold = pThreshold;
-        // TODO: trigger updates
+    }
+    
+    FillMode getFillMode() const
+    {
+        return mFillMode;
+    }
+    
+    void setFillMode(FillMode pFillMode)
+    {
+        mFillMode = pFillMode;
     }
     
     /**
+     Direction of the diagonal hatches, alternated between the layers of a project so that they cross.
      */
-    void blendPreview(const QImage& pSrc, QImage& pBlendedImage, const Tool& pTool, float pWidthMM) const override
+    bool getHatchDirection() const
+    {
+        return mHatchDirection;
+    }
+    
+    void setHatchDirection(bool pHatchDirection)
     {
-        assert(pBlendedImage.size() == pSrc.size());
+        mHatchDirection = pHatchDirection;
+    }
+    
+    /**
+     Time spent improving the order of the strokes of every refill batch, in milliseconds, 0 for no limit but the
+     number of passes of StrokeOrder, which keeps the G-code the same on any machine.
+     */
+    float getOrderingTimeBudgetMS() const
+    {
+        return mOrderingTimeBudgetMS;
+    }
+    
+    void setOrderingTimeBudgetMS(float pOrderingTimeBudgetMS)
+    {
+        mOrderingTimeBudgetMS = pOrderingTimeBudgetMS;
+    }
+    
+    /**
+     Distance to the traced strokes within which they are simplified, as a fraction of the width of the tool.
+     */
+    float getSimplificationTolerance() const
+    {
+        return mSimplificationTolerance;
+    }
+    
+    void setSimplificationTolerance(float pSimplificationTolerance)
+    {
+        mSimplificationTolerance = pSimplificationTolerance;
+    }
+    
+    /**
+     Moves the strokes are fitted with, within the simplification tolerance.
+     */
+    CurveFitter::Mode getCurveFitting() const
+    {
+        return mCurveFitting;
+    }
+    
+    void setCurveFitting(CurveFitter::Mode pCurveFitting)
+    {
+        mCurveFitting = pCurveFitting;
+    }
+    
+    /**
+     Directory of the on-disk cache of the essential image and of the traced paths, none if empty.
+     */
+    const std::string& getCacheDirectory() const
+    {
+        return mCacheDirectory;
+    }
+    
+    void setCacheDirectory(const std::string& pCacheDirectory)
+    {
+        mCacheDirectory = pCacheDirectory;
+    }
+
+    /**
+     Whether the text of the G-code is kept, so that compiling again with the same inputs writes it without emitting
+     it. It doubles the memory used by the text, and is only worth it when a layer is compiled several times.
+     */
+    void setKeepsGCode(bool pKeepsGCode)
+    {
+        mKeepsGCode = pKeepsGCode;
+        if (!pKeepsGCode)
+        {
+            mEmitStage.reset();
+        }
+    }
+    
+    /**
+     */
+    void blendPreview(const ThresholdBands& pSrc, QImage& pBlendedImage, const Tool& pTool, float pWidthMM) const override
+    {
+        assert(pBlendedImage.width() == (int)pSrc.getWidth());
+        assert(pBlendedImage.height() == (int)pSrc.getHeight());
         
 #if 1
         QColor lToolColour = pTool.getColour();
@@ -52,11 +174,13 @@ public:
         float lToolColourBlueFactor = lToolColour.blueF();
         
         //QImage lThresholded = pSrc.copy();
-        for (int y = 0 ; y != pSrc.height() ; ++y)
+        const ThresholdBands::Band cBand = pSrc.getDarkerBand(getThreshold());
+        for (int y = 0 ; y != (int)pSrc.getHeight() ; ++y)
         {
-            for (int x = 0 ; x != pSrc.width() ; ++x)
+            const ThresholdBands::Band* lRow = pSrc.getRow(y);
+            for (int x = 0 ; x != (int)pSrc.getWidth() ; ++x)
             {
-                bool lComputed = (pSrc.pixelColor(x, y).lightnessF() < getThreshold());
+                bool lComputed = (lRow[x] <= cBand);
                 if (lComputed)
                 {
                     QColor lColour = pBlendedImage.pixelColor(x, y);
@@ -75,279 +199,598 @@ public:
     
     /**
      Extract the path trace of the pencil as a binary image.
+     The result is kept, so that the preview and the compilation of a layer share the same trace, and kept in the
+     on-disk cache if there is one.
      */
-    BinaryImage essentialize(QImage pImage, float pWidthMM, const Tool& pTool) const
+    BinaryImage essentialize(const ThresholdBands& pImage, float pWidthMM, const Tool& pTool) const
     {
-        // width of the tool in pixels
-        const int cStepPixels = std::max(1, (int)std::floor(pTool.getWidthMM() * pImage.width() / pWidthMM));
-        
-        // Median
-#if 0
-        QImage lMedian = MorphOps::median(pImage);
-#else
-        QImage lMedian = pImage;
-#endif
-        
-        // Threshold
-        BinaryImage lBinaryImage(lMedian, getThreshold()); // TODO: static BinaryImage::thresholded(...)
-        
-        // Matrices of the paths
-        lBinaryImage.invert();
-        BinaryImage lBorders(lBinaryImage.getWidth(), lBinaryImage.getHeight());
-        
-#if 1
-        for (int u = 0 ; u < cStepPixels / 2 ; ++u)
-        {
-            MorphOps::thin(lBinaryImage);
-        }
-        lBorders.add(MorphOps::removeBorder(lBinaryImage));
-#if 0
-        for (int u = 0 ; u < cStepPixels - 1 - (cStepPixels / 2) ; ++u)
-#else
-        for (int u = 0 ; u < std::max(cStepPixels / 4, 1) ; ++u)
-#endif
+        return *getEssential(pImage, pWidthMM, pTool);
+    }
+    
+    /**
+     The G-code of the layer is computed in stages, each one kept with the inputs it was computed from: essential image,
+     traced skeleton, re-combined strokes in millimetres, ordered batches, then the text itself if setKeepsGCode() was
+     set. Compiling again computes only the stages whose inputs changed, and writes the kept text if none did.
+     */
+    void compile(const ThresholdBands& pImage, float pZoneSizeMMX, float pZoneSizeMMY, float pWidthMM, const Tool& pTool, GCodeWriter& pOut, LayerStatistics& pStatistics) const override
+    {
+        const OrderKey lOrderKey = getOrderKey(pImage, pZoneSizeMMX, pZoneSizeMMY, pWidthMM, pTool);
+        const EmitKey lKey(lOrderKey, pTool.getDragErrorMM(), (int)mCurveFitting, pOut.getDecimals(), pTool.getRefillCommand(), pTool.getDryTimeSeconds());
+        Profiler::Scope lScope("compile layer");
+        lScope.count("threshold", mThreshold);
+        const std::shared_ptr<const EmittedGCode> lKept = mKeepsGCode ? mEmitStage.find(lKey) : nullptr;
+        if (lKept)
         {
-            MorphOps::erode(lBinaryImage);
+            pOut.append(std::vector<std::string>(lKept->mChunks));
+            pOut.flush();
+            pStatistics = lKept->mStatistics;
+            lScope.count("kept", 1);
+            return;
         }
         
-        //lBorders.add(lBinaryImage);
-        static bool sDirection = true;
-        sDirection = !sDirection;
-        lBorders.add(MorphOps::diagonal(lBinaryImage, cStepPixels, sDirection));
-#elif 1
-        const int cSubStepPixels = std::max(2, (3 * cStepPixels) / 4);
-        while (! lBinaryImage.isEmpty())
-        {
-            for (int u = 0 ; u < cSubStepPixels / 2 ; ++u)
+        // the text is handed to pOut as it is written, and copied only if it is kept
+        const std::shared_ptr<const OrderedStrokes> lOrdered = getOrdered(lOrderKey, pImage, pZoneSizeMMX, pZoneSizeMMY, pWidthMM, pTool);
+        Profiler::Scope lEmitScope("emit");
+        std::vector<std::vector<CombinedPathMM>> lBatches = lOrdered->mBatches;
+        EmittedGCode lEmitted;
+        lEmitted.mStatistics = lOrdered->mStatistics;
+        size_t lNumBytes = 0;
+        size_t lNumLines = 0;
+        GCodeWriter lGCode(pOut.getDecimals());
+        lGCode.setSink([&](std::vector<std::string>&& pChunks) {
+            if (lEmitScope.isEnabled())
             {
-                MorphOps::thin(lBinaryImage);
-            }
-            lBorders.add(MorphOps::removeBorder(lBinaryImage));
-            for (int u = 0 ; u < cSubStepPixels - 1 - (cSubStepPixels / 2) ; ++u)
-            {
-                MorphOps::erode(lBinaryImage);
-            }
-        }
-#else
-        while (! lBinaryImage.isEmpty())
-        {
-            for (int u = 0 ; u < cStepPixels / 2 ; ++u)
-            {
-                MorphOps::thin(lBinaryImage);
+                for (const std::string& lChunk : pChunks)
+                {
+                    lNumBytes += lChunk.size();
+                    lNumLines += std::count(lChunk.begin(), lChunk.end(), '\n');
+                }
             }
-            lBorders.add(MorphOps::removeBorder(lBinaryImage));
-            for (int u = 0 ; u < cStepPixels - 1 - (cStepPixels / 2) ; ++u)
+            if (mKeepsGCode)
             {
-                MorphOps::thin(lBinaryImage);
+                lEmitted.mChunks.insert(lEmitted.mChunks.end(), pChunks.begin(), pChunks.end());
             }
-        }
-#endif
+            pOut.append(std::move(pChunks));
+            pOut.flush();
+        });
         
-        MorphOps::thin(lBorders);
+        // Convert to gcode
+        emit(lBatches, pTool, lGCode, lEmitted.mStatistics);
         
-        MorphOps::median(lBorders);
+        // Wait to dry
+        lGCode.dwell(pTool.getDryTimeSeconds() * 1000);
+        lGCode.flush();
+        lEmitScope.count("strokes", countStrokes(lBatches));
+        lEmitScope.count("linearMoves", lEmitted.mStatistics.mNumLinearMoves);
+        lEmitScope.count("fittedMoves", lEmitted.mStatistics.mNumFittedMoves);
+        lEmitScope.count("lines", lNumLines);
+        lEmitScope.count("bytes", lNumBytes);
         
-        return lBorders;
+        pStatistics = lEmitted.mStatistics;
+        if (mKeepsGCode)
+        {
+            mEmitStage.set(lKey, std::move(lEmitted));
+        }
     }
     
     /**
+     Number of times every stage has been computed, for the stages of the compilation in order.
      */
-    void compile(QImage pImage, float pZoneSizeMMX, float pZoneSizeMMY, float pWidthMM, const Tool& pTool, std::ofstream& pOut) const override
+    std::vector<size_t> getNumComputations() const
     {
-        BinaryImage lBorders = essentialize(pImage, pWidthMM, pTool);
-        
-        // Build the paths from the matrices
-        std::vector<PointPixel> lPointPixels;
-        for (int y = 0 ; y != lBorders.getHeight() ; ++y)
+        return {mEssentialStage.getNumComputations(), mTraceStage.getNumComputations(), mCombineStage.getNumComputations(),
+                mOrderStage.getNumComputations(), mEmitStage.getNumComputations()};
+    }
+    
+    /**
+     Re-combines pPaths: every path takes in turn the following paths that have an end close to one of its ends,
+     resuming after the last one taken, the end points being indexed by a grid.
+     */
+    static void recombine(std::vector<CombinedPathMM>& pPaths, const Tool& pTool)
+    {
+        const float lLimitDist = pTool.getWidthMM() * 2.f;
+        const int cNumPaths = (int)pPaths.size();
+        PointMM lMin = {0.f, 0.f};
+        PointMM lMax = {0.f, 0.f};
+        for (const auto& lPath : pPaths)
         {
-            for (int x = 0 ; x != lBorders.getWidth() ; ++x)
+            for (const PointMM& p : {lPath.mPoints.front(), lPath.mPoints.back()})
             {
-                if (lBorders.getPixel(x, y))
-                {
-                    lPointPixels.push_back({x,y});
-                }
+                lMin = {std::min(lMin.mX, p.mX), std::min(lMin.mY, p.mY)};
+                lMax = {std::max(lMax.mX, p.mX), std::max(lMax.mY, p.mY)};
             }
         }
-        // Combine paths
-        std::vector<CombinedPathsPixels> lCombinedPathPixels;
-        std::vector<PointPixel>::iterator lPointIt = lPointPixels.begin();
-        while (lPointIt != lPointPixels.end())
+        EndpointGrid lEndpoints(lLimitDist, lMin, lMax);
+        for (int i = 0 ; i != cNumPaths ; ++i)
+        {
+            lEndpoints.insert(i, pPaths[i].mPoints.front());
+            lEndpoints.insert(i, pPaths[i].mPoints.back());
+        }
+        std::vector<bool> lTaken(cNumPaths, false);
+        for (int i = 0 ; i != cNumPaths ; ++i)
         {
-            CombinedPathsPixels lCombinedPath({*lPointIt});
-            // find a path that begins or ends with one end touching the begin or end of this one.
-            auto lIt = lPointIt;
-            ++lIt;
-            while (lIt != lPointPixels.end())
+            if (lTaken[i])
+            {
+                continue;
+            }
+            CombinedPathMM& lPath = pPaths[i];
+            lEndpoints.remove(i, lPath.mPoints.front());
+            lEndpoints.remove(i, lPath.mPoints.back());
+            int lPosition = i;
+            while (!pTool.getNeedsRefill() || lPath.length() <= pTool.getLengthBeforeRefillMM())
             {
-                if (PointPixel::areNeighbour8(lCombinedPath.mPoints.back(), *lIt))
+                lPosition = lEndpoints.findFirst(lPath.mPoints.back(), lPath.mPoints.front(), lLimitDist, lPosition);
+                if (lPosition < 0)
                 {
-                    lCombinedPath.mPoints.push_back(*lIt);
-                    lIt = lPointPixels.erase(lIt);
+                    break;
                 }
-                else if (PointPixel::areNeighbour8(lCombinedPath.mPoints.front(), *lIt))
+                CombinedPathMM& lOther = pPaths[lPosition];
+                lEndpoints.remove(lPosition, lOther.mPoints.front());
+                lEndpoints.remove(lPosition, lOther.mPoints.back());
+                lTaken[lPosition] = true;
+                if (EndpointGrid::areWithin(lPath.mPoints.back(), lOther.mPoints.front(), lLimitDist))
                 {
-                    lCombinedPath.mPoints.push_front(*lIt);
-                    lIt = lPointPixels.erase(lIt);
+                    lPath.mPoints.insert(lPath.mPoints.end(), lOther.mPoints.begin(), lOther.mPoints.end());
                 }
-                else
+                else if (EndpointGrid::areWithin(lPath.mPoints.back(), lOther.mPoints.back(), lLimitDist))
                 {
-                    ++lIt;
+                    lPath.mPoints.insert(lPath.mPoints.end(), lOther.mPoints.rbegin(), lOther.mPoints.rend());
                 }
-            }
-            lCombinedPathPixels.push_back(lCombinedPath);
-            ++lPointIt;
-        }
-        
-        // simplify paths by removing points in colinear moves
-        for (auto& lPath : lCombinedPathPixels)
-        {
-            auto& lPoints = lPath.mPoints;
-            for(auto lIt = lPoints.begin() ; lIt != lPoints.end() ;)
-            {
-                if (std::distance(lIt, lPoints.end()) >= 3)
+                else if (EndpointGrid::areWithin(lPath.mPoints.front(), lOther.mPoints.front(), lLimitDist))
                 {
-                    auto lNext1 = std::next(lIt);
-                    auto lNext2 = std::next(lNext1);
-                    if (cross(*lNext1 - *lIt, *lNext2 - *lNext1) == 0)
-                    {
-                        // colinear, suppress *lNext1
-                        lPoints.erase(lNext1);
-                    }
-                    else
+                    for (auto lPointMM : lOther.mPoints)
                     {
-                        ++lIt;
+                        lPath.mPoints.push_front(lPointMM);
                     }
                 }
                 else
                 {
-                    ++lIt;
+                    lPath.mPoints.insert(lPath.mPoints.begin(), lOther.mPoints.begin(), lOther.mPoints.end());
                 }
+                lOther.mPoints.clear();
             }
         }
-        
-        // convert to physical coordinates
-        std::vector<CombinedPathMM> lCombinedPathMM;
-        float lMMperPixel = pWidthMM / pImage.width();
-        const float cXOffset = pZoneSizeMMX / 2.f + pWidthMM / 2.f;
-        const float cYOffset = pZoneSizeMMY / 2.f - pImage.height() * lMMperPixel / 2.f;
-        for (CombinedPathsPixels lCPP : lCombinedPathPixels)
+        size_t lNumKept = 0;
+        for (int i = 0 ; i != cNumPaths ; ++i)
         {
-            CombinedPathMM lCPMM;
-            for (PointPixel lPP : lCPP.mPoints)
+            if (!lTaken[i])
             {
-                float lXMM = cXOffset - lPP.mX * lMMperPixel;
-                float lYMM = cYOffset + lPP.mY * lMMperPixel;
-                lCPMM.mPoints.push_back({lXMM, lYMM});
+                pPaths[lNumKept++].mPoints.swap(pPaths[i].mPoints);
             }
-            lCombinedPathMM.push_back(lCPMM);
+        }
+        pPaths.resize(lNumKept);
+        
+        // the edges of the skeleton share their junction pixels, which are repeated where they have been joined
+        for (auto& lPath : pPaths)
+        {
+            lPath.mPoints.erase(std::unique(lPath.mPoints.begin(), lPath.mPoints.end(), [](PointMM a, PointMM b) {
+                return !(a != b);
+            }), lPath.mPoints.end());
+        }
+    }
+    
+private:
+    struct EssentialKey
+    {
+        qint64 mImageKey;
+        float mThreshold;
+        float mToolWidthMM;
+        float mWidthMM;
+        FillMode mFillMode;
+        bool mHatchDirection;
+        
+        bool operator ==(const EssentialKey& pOther) const
+        {
+            return mImageKey == pOther.mImageKey
+                && mThreshold == pOther.mThreshold
+                && mToolWidthMM == pOther.mToolWidthMM
+                && mWidthMM == pOther.mWidthMM
+                && mFillMode == pOther.mFillMode
+                && mHatchDirection == pOther.mHatchDirection;
+        }
+    };
+    
+    /**
+     Inputs of the stages after the essential image: the mm per pixel, the width of the tool, whether it needs refills
+     and the length it draws before one for the re-combined strokes, plus the offsets in the print area, the
+     simplification tolerance, the refill station and the ordering time budget for the ordered batches, plus the drag
+     error, the curve fitting, the decimals, the refill command and the dry time for the text.
+     */
+    typedef std::tuple<EssentialKey, float, float, bool, float> CombineKey;
+    typedef std::tuple<CombineKey, float, float, float, float, float, float> OrderKey;
+    typedef std::tuple<OrderKey, float, int, int, std::string, int> EmitKey;
+    
+    CombineKey getCombineKey(const ThresholdBands& pImage, float pWidthMM, const Tool& pTool) const
+    {
+        return CombineKey(getEssentialKey(pImage, pWidthMM, pTool), pWidthMM / pImage.getWidth(), pTool.getWidthMM(), pTool.getNeedsRefill(), pTool.getNeedsRefill() ? pTool.getLengthBeforeRefillMM() : 0.f);
+    }
+    
+    OrderKey getOrderKey(const ThresholdBands& pImage, float pZoneSizeMMX, float pZoneSizeMMY, float pWidthMM, const Tool& pTool) const
+    {
+        return OrderKey(getCombineKey(pImage, pWidthMM, pTool), pZoneSizeMMX, pZoneSizeMMY, mSimplificationTolerance, pTool.getRefillStationXMM(), pTool.getRefillStationYMM(), mOrderingTimeBudgetMS);
+    }
+    
+    EssentialKey getEssentialKey(const ThresholdBands& pImage, float pWidthMM, const Tool& pTool) const
+    {
+        return {pImage.getSourceKey(), mThreshold, pTool.getWidthMM(), pWidthMM, mFillMode, mHatchDirection};
+    }
+    
+    struct OrderedStrokes
+    {
+        std::vector<std::vector<CombinedPathMM>> mBatches;
+        LayerStatistics mStatistics;
+    };
+    
+    struct EmittedGCode
+    {
+        std::vector<std::string> mChunks;
+        LayerStatistics mStatistics;
+    };
+    
+    /**
+     Writes the refill command then the strokes of every batch.
+     Contiguous chunks of strokes are formatted concurrently into their own writer, which starts from the position the
+     previous stroke ends at, then appended in order: the text is the same as if they were written one after the other.
+     The chunks are appended and flushed as soon as they and the ones before them are formatted, so that a streamed layer
+     starts with its first refill batches while the next ones are formatted.
+     */
+    void emit(std::vector<std::vector<CombinedPathMM>>& pBatches, const Tool& pTool, GCodeWriter& pOut, LayerStatistics& pStatistics) const
+    {
+        if (pBatches.empty())
+        {
+            pOut.raw(pTool.getRefillCommand());
+            pOut.flush();
+            return;
         }
         
-        // re-combine
-        float lLimitDist = pTool.getWidthMM() * 2.f;
-        for (auto lIt = lCombinedPathMM.begin() ; lIt != lCombinedPathMM.end() ; ++lIt)
+        struct Chunk
         {
-            for (auto lOtherIt = std::next(lIt) ; lOtherIt != lCombinedPathMM.end() ; )
+            size_t mBatch;
+            size_t mBegin;
+            size_t mEnd;
+        };
+        const size_t cStrokesPerChunk = 256;
+        std::vector<Chunk> lChunks;
+        for (size_t b = 0 ; b != pBatches.size() ; ++b)
+        {
+            for (size_t u = 0 ; u == 0 || u < pBatches[b].size() ; u += cStrokesPerChunk)
+            {
+                lChunks.push_back({b, u, std::min(u + cStrokesPerChunk, pBatches[b].size())});
+            }
+        }
+        
+        // a chunk reads the end of the stroke before it, which is fixed first
+        ThreadPool::getInstance().parallelFor(0, (int)lChunks.size(), [&](int c) {
+            for (size_t u = lChunks[c].mBegin ; u != lChunks[c].mEnd ; ++u)
+            {
+                pBatches[lChunks[c].mBatch][u].fixDragError(pTool.getDragErrorMM());
+            }
+        });
+        
+        const CurveFitter lFitter(mCurveFitting, mSimplificationTolerance * pTool.getWidthMM());
+        std::vector<GCodeWriter> lChunksGCode(lChunks.size(), GCodeWriter(pOut.getDecimals()));
+        std::vector<LayerStatistics> lChunksStatistics(lChunks.size());
+        std::vector<bool> lFormatted(lChunks.size(), false);
+        size_t lNumAppended = 0;
+        std::mutex lAppendMutex;
+        ThreadPool::getInstance().parallelFor(0, (int)lChunks.size(), [&](int c) {
+            const std::vector<CombinedPathMM>& lBatch = pBatches[lChunks[c].mBatch];
+            GCodeWriter& lOut = lChunksGCode[c];
+            if (lChunks[c].mBegin == 0)
+            {
+                lOut.raw(pTool.getRefillCommand());
+            }
+            else
+            {
+                const PointMM lEnd = lBatch[lChunks[c].mBegin - 1].mPoints.back();
+                lOut.setPosition(lEnd.mX, lEnd.mY, 2.5f);
+            }
+            for (size_t u = lChunks[c].mBegin ; u != lChunks[c].mEnd ; ++u)
             {
-                if (pTool.getNeedsRefill() && lIt->length() > pTool.getLengthBeforeRefillMM())
+                lChunksStatistics[c].mNumLinearMoves += (int)lBatch[u].mPoints.size();
+                lChunksStatistics[c].mNumFittedMoves += (int)lFitter.compile(lBatch[u], lOut);
+            }
+            
+            std::lock_guard<std::mutex> lLock(lAppendMutex);
+            lFormatted[c] = true;
+            while (lNumAppended != lChunks.size() && lFormatted[lNumAppended])
+            {
+                pStatistics.mNumLinearMoves += lChunksStatistics[lNumAppended].mNumLinearMoves;
+                pStatistics.mNumFittedMoves += lChunksStatistics[lNumAppended].mNumFittedMoves;
+                pOut.append(std::move(lChunksGCode[lNumAppended]));
+                ++lNumAppended;
+            }
+            pOut.flush();
+        });
+    }
+    
+    /**
+     Essential image of the layer, kept in the on-disk cache if there is one.
+     */
+    std::shared_ptr<const BinaryImage> getEssential(const ThresholdBands& pImage, float pWidthMM, const Tool& pTool) const
+    {
+        return mEssentialStage.get(getEssentialKey(pImage, pWidthMM, pTool), [&]() {
+            Profiler::Scope lScope("essentialize");
+            BinaryImage lEssential(0, 0, false);
+            const PackedBinaryImage lMask = pImage.getDarkerMask(getThreshold());
+            const int cStepPixels = getStepPixels(pImage, pWidthMM, pTool);
+            // the mask is only hashed when there is a cache to look up
+            LayerCache::Key lCacheKey;
+            if (!mCacheDirectory.empty())
+            {
+                lCacheKey = getEssentialCacheKey(lMask, cStepPixels);
+            }
+            const bool lCached = !mCacheDirectory.empty() && LayerCache(mCacheDirectory).load(lCacheKey, lEssential);
+            if (!lCached)
+            {
+                lEssential = computeEssential(lMask, cStepPixels);
+                if (!mCacheDirectory.empty())
                 {
-                    break;
+                    LayerCache(mCacheDirectory).store(lCacheKey, lEssential);
                 }
-                else if (PointMM::length(lIt->mPoints.back(), lOtherIt->mPoints.front()) < lLimitDist)
+            }
+            if (lScope.isEnabled())
+            {
+                lScope.count("pixels", (double)lMask.getWidth() * lMask.getHeight());
+                lScope.count("maskPixels", lMask.countPixels());
+                lScope.count("essentialPixels", PackedBinaryImage(lEssential).countPixels());
+                lScope.count("cached", lCached);
+            }
+            return lEssential;
+        });
+    }
+    
+    /**
+     Paths of the skeleton of the essential image, in pixels.
+     */
+    std::shared_ptr<const std::vector<CombinedPathsPixels>> getTrace(const ThresholdBands& pImage, float pWidthMM, const Tool& pTool) const
+    {
+        return mTraceStage.get(getEssentialKey(pImage, pWidthMM, pTool), [&]() {
+            const std::shared_ptr<const BinaryImage> lEssential = getEssential(pImage, pWidthMM, pTool);
+            Profiler::Scope lScope("trace");
+            
+            // Build the paths from the graph of the skeleton
+            std::vector<CombinedPathsPixels> lCombinedPathPixels = SkeletonTracer(*lEssential).trace();
+            lScope.count("paths", lCombinedPathPixels.size());
+            lScope.count("pointsTraced", countPoints(lCombinedPathPixels));
+            
+            // simplify paths by removing points in colinear moves
+            for (auto& lPath : lCombinedPathPixels)
+            {
+                auto& lPoints = lPath.mPoints;
+                for(auto lIt = lPoints.begin() ; lIt != lPoints.end() ;)
                 {
-                    for (auto lPointMM : lOtherIt->mPoints)
+                    if (std::distance(lIt, lPoints.end()) >= 3)
                     {
-                        lIt->mPoints.push_back(lPointMM);
+                        auto lNext1 = std::next(lIt);
+                        auto lNext2 = std::next(lNext1);
+                        if (cross(*lNext1 - *lIt, *lNext2 - *lNext1) == 0)
+                        {
+                            // colinear, suppress *lNext1
+                            lPoints.erase(lNext1);
+                        }
+                        else
+                        {
+                            ++lIt;
+                        }
                     }
-                    lOtherIt = lCombinedPathMM.erase(lOtherIt);
-                }
-                else if (PointMM::length(lIt->mPoints.back(), lOtherIt->mPoints.back()) < lLimitDist)
-                {
-                    for (auto lPointMMIt = lOtherIt->mPoints.rbegin() ; lPointMMIt != lOtherIt->mPoints.rend() ; ++lPointMMIt)
+                    else
                     {
-                        lIt->mPoints.push_back(*lPointMMIt);
+                        ++lIt;
                     }
-                    lOtherIt = lCombinedPathMM.erase(lOtherIt);
                 }
-                else if (PointMM::length(lIt->mPoints.front(), lOtherIt->mPoints.front()) < lLimitDist)
+            }
+            lScope.count("pointsNotColinear", countPoints(lCombinedPathPixels));
+            return lCombinedPathPixels;
+        });
+    }
+    
+    /**
+     Strokes traced along the essential image, in millimetres from its top right corner, the X axis being reversed.
+     They are kept in the on-disk cache if there is one, as they do not depend on the print area.
+     */
+    std::shared_ptr<const std::vector<CombinedPathMM>> getCombined(const ThresholdBands& pImage, float pWidthMM, const Tool& pTool) const
+    {
+        return mCombineStage.get(getCombineKey(pImage, pWidthMM, pTool), [&]() {
+            std::vector<CombinedPathMM> lCombinedPathMM;
+            const float cMMperPixel = pWidthMM / pImage.getWidth();
+            const float cLengthBeforeRefillMM = pTool.getNeedsRefill() ? pTool.getLengthBeforeRefillMM() : 0.f;
+            // the mask is only built and hashed when there is a cache to look up
+            LayerCache::Key lCacheKey;
+            if (!mCacheDirectory.empty())
+            {
+                lCacheKey = getEssentialCacheKey(pImage.getDarkerMask(getThreshold()), getStepPixels(pImage, pWidthMM, pTool));
+                lCacheKey.add(cMMperPixel).add(pTool.getWidthMM()).add(pTool.getNeedsRefill()).add(cLengthBeforeRefillMM);
+                if (LayerCache(mCacheDirectory).load(lCacheKey, lCombinedPathMM))
                 {
-                    for (auto lPointMM : lOtherIt->mPoints)
-                    {
-                        lIt->mPoints.push_front(lPointMM);
-                    }
-                    lOtherIt = lCombinedPathMM.erase(lOtherIt);
+                    return lCombinedPathMM;
                 }
-                else if (PointMM::length(lIt->mPoints.front(), lOtherIt->mPoints.back()) < lLimitDist)
+            }
+            
+            // convert to physical coordinates, from the top right corner of the image
+            const std::shared_ptr<const std::vector<CombinedPathsPixels>> lCombinedPathPixels = getTrace(pImage, pWidthMM, pTool);
+            Profiler::Scope lScope("recombine");
+            for (const CombinedPathsPixels& lCPP : *lCombinedPathPixels)
+            {
+                CombinedPathMM lCPMM;
+                for (PointPixel lPP : lCPP.mPoints)
                 {
-                    for (auto lPointMMIt = lOtherIt->mPoints.rbegin() ; lPointMMIt != lOtherIt->mPoints.rend() ; ++lPointMMIt)
-                    {
-                        lIt->mPoints.push_front(*lPointMMIt);
-                    }
-                    lOtherIt = lCombinedPathMM.erase(lOtherIt);
+                    float lXMM = -lPP.mX * cMMperPixel;
+                    float lYMM = lPP.mY * cMMperPixel;
+                    lCPMM.mPoints.push_back({lXMM, lYMM});
                 }
-                else
+                lCombinedPathMM.push_back(lCPMM);
+            }
+            
+            lScope.count("paths", lCombinedPathMM.size());
+            recombine(lCombinedPathMM, pTool);
+            lScope.count("strokes", lCombinedPathMM.size());
+            lScope.count("points", countPoints(lCombinedPathMM));
+            
+            if (!mCacheDirectory.empty())
+            {
+                LayerCache(mCacheDirectory).store(lCacheKey, lCombinedPathMM);
+            }
+            return lCombinedPathMM;
+        });
+    }
+    
+    /**
+     Strokes placed in the middle of the print area, simplified, and split into the batches drawn between two refills.
+     */
+    std::shared_ptr<const OrderedStrokes> getOrdered(const OrderKey& pKey, const ThresholdBands& pImage, float pZoneSizeMMX, float pZoneSizeMMY, float pWidthMM, const Tool& pTool) const
+    {
+        return mOrderStage.get(pKey, [&]() {
+            std::vector<CombinedPathMM> lCombinedPathMM = *getCombined(pImage, pWidthMM, pTool);
+            const float cMMperPixel = pWidthMM / pImage.getWidth();
+            const float cXOffset = pZoneSizeMMX / 2.f + pWidthMM / 2.f;
+            const float cYOffset = pZoneSizeMMY / 2.f - pImage.getHeight() * cMMperPixel / 2.f;
+            for (auto& lPath : lCombinedPathMM)
+            {
+                for (PointMM& lPoint : lPath.mPoints)
                 {
-                    ++lOtherIt;
+                    lPoint = {cXOffset + lPoint.mX, cYOffset + lPoint.mY};
                 }
             }
+            
+            // simplify within a fraction of the width of the tool
+            int lNumPointsTraced = 0;
+            int lNumPointsSimplified = 0;
+            {
+                Profiler::Scope lScope("simplify");
+                for (auto& lPath : lCombinedPathMM)
+                {
+                    lNumPointsTraced += (int)lPath.mPoints.size();
+                    lPath.simplify(mSimplificationTolerance * pTool.getWidthMM());
+                    lNumPointsSimplified += (int)lPath.mPoints.size();
+                }
+                lScope.count("pointsBefore", lNumPointsTraced);
+                lScope.count("pointsAfter", lNumPointsSimplified);
+            }
+            
+            // batches drawn between two refills
+            Profiler::Scope lScope("order");
+            lScope.count("strokes", lCombinedPathMM.size());
+            OrderedStrokes lOrdered;
+            lOrdered.mBatches = RefillScheduler(pTool, mOrderingTimeBudgetMS).schedule(lCombinedPathMM, lOrdered.mStatistics);
+            lOrdered.mStatistics.mNumPointsTraced = lNumPointsTraced;
+            lOrdered.mStatistics.mNumPointsSimplified = lNumPointsSimplified;
+            lScope.count("batches", lOrdered.mBatches.size());
+            lScope.count("travelBeforeMM", lOrdered.mStatistics.mTravelBeforeMM);
+            lScope.count("travelAfterMM", lOrdered.mStatistics.mTravelAfterMM);
+            return lOrdered;
+        });
+    }
+    
+    template <typename Path>
+    static size_t countPoints(const std::vector<Path>& pPaths)
+    {
+        size_t lNumPoints = 0;
+        for (const Path& lPath : pPaths)
+        {
+            lNumPoints += lPath.mPoints.size();
+        }
+        return lNumPoints;
+    }
+    
+    static size_t countStrokes(const std::vector<std::vector<CombinedPathMM>>& pBatches)
+    {
+        size_t lNumStrokes = 0;
+        for (const auto& lBatch : pBatches)
+        {
+            lNumStrokes += lBatch.size();
         }
+        return lNumStrokes;
+    }
+    
+    /**
+     Width of the tool in pixels.
+     */
+    static int getStepPixels(const ThresholdBands& pImage, float pWidthMM, const Tool& pTool)
+    {
+        return std::max(1, (int)std::floor(pTool.getWidthMM() * pImage.getWidth() / pWidthMM));
+    }
+    
+    LayerCache::Key getEssentialCacheKey(const PackedBinaryImage& pMask, int pStepPixels) const
+    {
+        return LayerCache::Key().add(pMask).add(pStepPixels).add(mFillMode).add(mHatchDirection);
+    }
+    
+    /**
+     Essential image of the darker mask pMask of the layer, for a tool pStepPixels wide.
+     */
+    BinaryImage computeEssential(const PackedBinaryImage& pMask, int pStepPixels) const
+    {
+        // Matrices of the paths, bit-packed for the morphological operators
+        PackedBinaryImage lPaths = pMask;
+        PackedBinaryImage lBorders(lPaths.getWidth(), lPaths.getHeight());
         
-#if 0
-        // Convert to gcode
-        float lLength = 0.f;
-        pOut << pTool.getReloadCommand();
-        for (auto& lPath : lCombinedPathMM)
+        if (mFillMode == eHatchFill)
         {
-            lPath.fixDragError(pTool.getDragErrorMM());
-            lPath.compile(pOut);
-            lLength += lPath.length();
-            lLength += 0.5f; // each one spills some ink
-            if (pTool.getNeedsReload() && lLength > pTool.getLengthBeforeReloadMM())
             {
-                pOut << pTool.getReloadCommand();
-                lLength = 0.f;
+                Profiler::Scope lScope("thin to the width of the tool");
+                lScope.count("passes", MorphOps::thin(lPaths, pStepPixels / 2));
             }
-        }
+            {
+                Profiler::Scope lScope("remove border");
+                lBorders.add(MorphOps::removeBorder(lPaths));
+            }
+            {
+                Profiler::Scope lScope("erode");
+#if 0
+                MorphOps::erode(lPaths, MorphOps::eSquareElement, pStepPixels - 1 - (pStepPixels / 2));
 #else
-        // Convert to gcode while sorting pathes by length so that no ink drip occurs on short pathes
-        float lLength = 0.f;
-        pOut << pTool.getRefillCommand();
-        std::vector<CombinedPathMM> lPathes;
-        for (auto& lPath : lCombinedPathMM)
+                MorphOps::erode(lPaths, MorphOps::eSquareElement, std::max(pStepPixels / 4, 1));
+#endif
+            }
+            
+            //lBorders.add(lPaths);
+            Profiler::Scope lScope("diagonal");
+            lBorders.add(MorphOps::diagonal(lPaths, pStepPixels, mHatchDirection));
+        }
+        else
         {
-            if (pTool.getNeedsRefill())
+            // the outer contour is found by thinning so that narrow parts keep a stroke,
+            // the inner ones are the level sets of the distance to it
+            const int cSubStepPixels = std::max(2, (3 * pStepPixels) / 4);
             {
-                lLength += lPath.length() + 2.f; // as each one spills ink
-                lPathes.push_back(lPath);
-                if (lLength > pTool.getLengthBeforeRefillMM())
-                {
-                    std::sort(lPathes.begin(), lPathes.end(),
-                              [](CombinedPathMM& p1, CombinedPathMM& p2) {
-                                  return p1.length() > p2.length();
-                              });
-                    for (auto& p : lPathes)
-                    {
-                        p.fixDragError(pTool.getDragErrorMM());
-                        p.compile(pOut);
-                    }
-                    pOut << pTool.getRefillCommand();
-                    lLength = 0.f;
-                    lPathes.clear();
-                }
+                Profiler::Scope lScope("thin to the width of the tool");
+                lScope.count("passes", MorphOps::thin(lPaths, cSubStepPixels / 2));
             }
-            else
             {
-                lPath.fixDragError(pTool.getDragErrorMM());
-                lPath.compile(pOut);
+                Profiler::Scope lScope("remove border");
+                lBorders.add(MorphOps::removeBorder(lPaths));
             }
+            Profiler::Scope lScope("concentric contours");
+            lBorders.add(MorphOps::concentricContours(lPaths, cSubStepPixels, 1));
         }
-#endif
         
-        // Wait to dry
-        pOut << "G4 P" << pTool.getDryTimeSeconds() << "000" << std::endl;
+        {
+            Profiler::Scope lScope("thin the strokes");
+            MorphOps::thin(lBorders);
+        }
+        
+        {
+            Profiler::Scope lScope("median");
+            MorphOps::median(lBorders);
+        }
+        
+        return lBorders.toBinaryImage();
     }
     
-private:
     float mThreshold;
+    FillMode mFillMode;
+    bool mHatchDirection = false;
+    float mOrderingTimeBudgetMS = 0.f;
+    float mSimplificationTolerance = 0.1f;
+    CurveFitter::Mode mCurveFitting = CurveFitter::eLines;
+    std::string mCacheDirectory;
+    bool mKeepsGCode = false;
+    mutable Stage<EssentialKey, BinaryImage> mEssentialStage;
+    mutable Stage<EssentialKey, std::vector<CombinedPathsPixels>> mTraceStage;
+    mutable Stage<CombineKey, std::vector<CombinedPathMM>> mCombineStage;
+    mutable Stage<OrderKey, OrderedStrokes> mOrderStage;
+    mutable Stage<EmitKey, EmittedGCode> mEmitStage;
 };
 
 }
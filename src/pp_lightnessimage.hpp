@@ -0,0 +1,180 @@
+#ifndef PP_LIGHTNESSIMAGE_HPP_INCLUDED
+#define PP_LIGHTNESSIMAGE_HPP_INCLUDED
+
+/**
+ @file      pp_lightnessimage.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include <QColor>
+#include <QImage>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define PP_LIGHTNESS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace PP
+{
+
+/**
+ Lightness plane of an image, computed once and thresholded by all the layers.
+ The values are the 16 bit lightness of QColor, so that comparing them to getCutoff(t) gives exactly the same result
+ as comparing QColor::lightnessF() to t.
+ */
+class LightnessImage
+{
+public:
+    typedef uint16_t Value;
+
+    LightnessImage()
+    : mWidth(0)
+    , mHeight(0)
+    , mSourceKey(0)
+    {
+    }
+
+    explicit LightnessImage(const QImage& pImage)
+    : mWidth(pImage.width())
+    , mHeight(pImage.height())
+    , mSourceKey(pImage.cacheKey())
+    , mData(mWidth * mHeight)
+    {
+        // 32 bit pixels, premultiplied and narrower formats being converted like pixelColor() does
+        QImage lImage = pImage;
+        if (lImage.format() != QImage::Format_RGB32 && lImage.format() != QImage::Format_ARGB32)
+        {
+            lImage = pImage.convertToFormat(QImage::Format_ARGB32);
+        }
+
+        const Value* lTable = getTable();
+        std::vector<uint16_t> lMaxMin(mWidth);
+        for (size_t y = 0 ; y != mHeight ; ++y)
+        {
+            const uint32_t* lPixels = reinterpret_cast<const uint32_t*>(lImage.constScanLine(y));
+            computeMaxMin(lPixels, mWidth, lMaxMin.data());
+            Value* lRow = &mData[y * mWidth];
+            for (size_t x = 0 ; x != mWidth ; ++x)
+            {
+                lRow[x] = lTable[lMaxMin[x]];
+            }
+        }
+    }
+
+    size_t getWidth() const
+    {
+        return mWidth;
+    }
+
+    size_t getHeight() const
+    {
+        return mHeight;
+    }
+
+    /**
+     QImage::cacheKey() of the image this plane was computed from.
+     */
+    qint64 getSourceKey() const
+    {
+        return mSourceKey;
+    }
+
+    const Value* getRow(size_t y) const
+    {
+        return &mData[y * mWidth];
+    }
+
+    Value getValue(size_t x, size_t y) const
+    {
+        return mData[y * mWidth + x];
+    }
+
+    /**
+     The smallest value whose lightness is greater than or equal to pThreshold, 65536 if there is none.
+     */
+    static uint32_t getCutoff(float pThreshold)
+    {
+        uint32_t lLow = 0;
+        uint32_t lHigh = 65536;
+        while (lLow < lHigh)
+        {
+            const uint32_t lMiddle = (lLow + lHigh) / 2;
+            if (lMiddle / 65535.0 >= pThreshold)
+            {
+                lHigh = lMiddle;
+            }
+            else
+            {
+                lLow = lMiddle + 1;
+            }
+        }
+        return lLow;
+    }
+
+private:
+    /**
+     Lightness indexed by (max << 8) | min of the components of a pixel, as computed by QColor.
+     */
+    static const Value* getTable()
+    {
+        static const std::vector<Value> sTable = []() {
+            std::vector<Value> lTable(256 * 256, 0);
+            for (int lMax = 0 ; lMax != 256 ; ++lMax)
+            {
+                for (int lMin = 0 ; lMin <= lMax ; ++lMin)
+                {
+                    const double lLightness = QColor(lMax, lMin, lMin).lightnessF();
+                    lTable[(lMax << 8) | lMin] = (Value)std::lround(lLightness * 65535.0);
+                }
+            }
+            return lTable;
+        }();
+        return sTable.data();
+    }
+
+    /**
+     (max << 8) | min of the red, green and blue components of every pixel.
+     */
+    static void computeMaxMin(const uint32_t* pPixels, size_t pNumPixels, uint16_t* pMaxMin)
+    {
+        size_t x = 0;
+#if PP_LIGHTNESS_SSE2
+        // 4 pixels per vector, the components being reduced to the lowest byte of every 32 bit lane
+        const __m128i cLowByte = _mm_set1_epi32(0xff);
+        for ( ; x + 4 <= pNumPixels ; x += 4)
+        {
+            const __m128i lPixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pPixels + x));
+            const __m128i lGreen = _mm_srli_epi32(lPixels, 8);
+            const __m128i lRed = _mm_srli_epi32(lPixels, 16);
+            const __m128i lMax = _mm_and_si128(_mm_max_epu8(_mm_max_epu8(lPixels, lGreen), lRed), cLowByte);
+            const __m128i lMin = _mm_and_si128(_mm_min_epu8(_mm_min_epu8(lPixels, lGreen), lRed), cLowByte);
+            const __m128i lMaxMin = _mm_or_si128(_mm_slli_epi32(lMax, 8), lMin);
+            // lanes are below 65536, pack them to 16 bit
+            const __m128i lPacked = _mm_packs_epi32(_mm_sub_epi32(lMaxMin, _mm_set1_epi32(32768)), _mm_setzero_si128());
+            const __m128i lUnbiased = _mm_xor_si128(lPacked, _mm_set1_epi16((short)0x8000));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(pMaxMin + x), lUnbiased);
+        }
+#endif
+        for ( ; x != pNumPixels ; ++x)
+        {
+            const QRgb lPixel = pPixels[x];
+            const int lMax = std::max(qRed(lPixel), std::max(qGreen(lPixel), qBlue(lPixel)));
+            const int lMin = std::min(qRed(lPixel), std::min(qGreen(lPixel), qBlue(lPixel)));
+            pMaxMin[x] = (uint16_t)((lMax << 8) | lMin);
+        }
+    }
+
+    size_t mWidth;
+    size_t mHeight;
+    qint64 mSourceKey;
+    std::vector<Value> mData;
+};
+
+}
+
+#endif
@@ -0,0 +1,610 @@
+#ifndef PP_PACKEDBINARYIMAGE_HPP_INCLUDED
+#define PP_PACKEDBINARYIMAGE_HPP_INCLUDED
+
+/**
+ @file      pp_packedbinaryimage.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include "pp_threadpool.hpp"
+#include "pp_utils.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <vector>
+
+namespace PP
+{
+
+/**
+ Bit-packed binary image: 64 pixels per row word, pixel x of a row being bit (x % 64) of word (x / 64).
+ The padding bits after the last pixel of a row are always kept cleared so that they read as background.
+ */
+class PackedBinaryImage
+{
+public:
+    typedef uint64_t Word;
+
+    static const int cBitsPerWord = 64;
+
+    PackedBinaryImage(size_t pWidth, size_t pHeight)
+    : mWidth(pWidth)
+    , mHeight(pHeight)
+    , mWordsPerRow((pWidth + cBitsPerWord - 1) / cBitsPerWord)
+    , mData(mWordsPerRow * pHeight, 0)
+    {
+    }
+
+    explicit PackedBinaryImage(const BinaryImage& pImage)
+    : PackedBinaryImage(pImage.getWidth(), pImage.getHeight())
+    {
+        for (size_t y = 0 ; y != mHeight ; ++y)
+        {
+            Word* lRow = getRow(y);
+            for (size_t x = 0 ; x != mWidth ; ++x)
+            {
+                if (pImage.getPixel(x, y))
+                {
+                    lRow[x / cBitsPerWord] |= Word(1) << (x % cBitsPerWord);
+                }
+            }
+        }
+    }
+
+    BinaryImage toBinaryImage() const
+    {
+        BinaryImage lReturn(mWidth, mHeight, false);
+        for (size_t y = 0 ; y != mHeight ; ++y)
+        {
+            const Word* lRow = getRow(y);
+            for (size_t x = 0 ; x != mWidth ; ++x)
+            {
+                lReturn.getPixel(x, y) = ((lRow[x / cBitsPerWord] >> (x % cBitsPerWord)) & 1) != 0;
+            }
+        }
+        return lReturn;
+    }
+
+    size_t getWidth() const
+    {
+        return mWidth;
+    }
+
+    size_t getHeight() const
+    {
+        return mHeight;
+    }
+
+    size_t getWordsPerRow() const
+    {
+        return mWordsPerRow;
+    }
+
+    Word* getRow(size_t y)
+    {
+        assert(y < mHeight);
+        return mData.data() + y * mWordsPerRow;
+    }
+
+    const Word* getRow(size_t y) const
+    {
+        assert(y < mHeight);
+        return mData.data() + y * mWordsPerRow;
+    }
+
+    size_t getNumWords() const
+    {
+        return mData.size();
+    }
+
+    /**
+     Word at the given index of the row-major array of all words.
+     */
+    Word& getWord(size_t pIndex)
+    {
+        assert(pIndex < mData.size());
+        return mData[pIndex];
+    }
+
+    const Word& getWord(size_t pIndex) const
+    {
+        assert(pIndex < mData.size());
+        return mData[pIndex];
+    }
+
+    bool getPixel(size_t x, size_t y) const
+    {
+        assert(x < mWidth);
+        return ((getRow(y)[x / cBitsPerWord] >> (x % cBitsPerWord)) & 1) != 0;
+    }
+
+    void setPixel(size_t x, size_t y, bool pValue)
+    {
+        assert(x < mWidth);
+        Word& lWord = getRow(y)[x / cBitsPerWord];
+        const Word lBit = Word(1) << (x % cBitsPerWord);
+        lWord = pValue ? (lWord | lBit) : (lWord & ~lBit);
+    }
+
+    /**
+     Mask of the meaningful bits of the last word of a row.
+     */
+    Word getLastWordMask() const
+    {
+        const size_t lUsedBits = mWidth % cBitsPerWord;
+        return lUsedBits == 0 ? ~Word(0) : ((Word(1) << lUsedBits) - 1);
+    }
+
+    void invert()
+    {
+        if (mWordsPerRow == 0)
+        {
+            return;
+        }
+        const Word lLastWordMask = getLastWordMask();
+        for (size_t y = 0 ; y != mHeight ; ++y)
+        {
+            Word* lRow = getRow(y);
+            for (size_t k = 0 ; k != mWordsPerRow ; ++k)
+            {
+                lRow[k] = ~lRow[k];
+            }
+            lRow[mWordsPerRow - 1] &= lLastWordMask;
+        }
+    }
+
+    /**
+     Number of set pixels.
+     */
+    size_t countPixels() const
+    {
+        size_t lCount = 0;
+        for (Word lWord : mData)
+        {
+            lCount += std::bitset<cBitsPerWord>(lWord).count();
+        }
+        return lCount;
+    }
+
+    bool isEmpty() const
+    {
+        for (Word lWord : mData)
+        {
+            if (lWord != 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void add(const PackedBinaryImage& pOther)
+    {
+        assert(mWidth == pOther.mWidth);
+        assert(mHeight == pOther.mHeight);
+        for (size_t u = 0 ; u != mData.size() ; ++u)
+        {
+            mData[u] |= pOther.mData[u];
+        }
+    }
+
+    void clear()
+    {
+        std::fill(mData.begin(), mData.end(), Word(0));
+    }
+
+    void swap(PackedBinaryImage& pOther)
+    {
+        std::swap(mWidth, pOther.mWidth);
+        std::swap(mHeight, pOther.mHeight);
+        std::swap(mWordsPerRow, pOther.mWordsPerRow);
+        mData.swap(pOther.mData);
+    }
+
+private:
+    size_t mWidth = 0;
+    size_t mHeight = 0;
+    size_t mWordsPerRow = 0;
+    std::vector<Word> mData;
+};
+
+/**
+ The 8 neighbours of the 64 pixels of a row word, with the labels used by MorphOps::thinReference:
+ p2 (x-1,y), p3 (x-1,y+1), p4 (x,y+1), p5 (x+1,y+1), p6 (x+1,y), p7 (x+1,y-1), p8 (x,y-1), p9 (x-1,y-1).
+ Pixels outside the image read as background.
+ */
+struct PackedNeighbourhood
+{
+    typedef PackedBinaryImage::Word Word;
+
+    Word p2, p3, p4, p5, p6, p7, p8, p9;
+
+    PackedNeighbourhood(const Word* pAbove, const Word* pRow, const Word* pBelow, size_t pIndex, size_t pNumWords)
+    {
+        p8 = pAbove[pIndex];
+        p4 = pBelow[pIndex];
+        p9 = shiftedLeft(pAbove, pIndex);
+        p2 = shiftedLeft(pRow, pIndex);
+        p3 = shiftedLeft(pBelow, pIndex);
+        p7 = shiftedRight(pAbove, pIndex, pNumWords);
+        p6 = shiftedRight(pRow, pIndex, pNumWords);
+        p5 = shiftedRight(pBelow, pIndex, pNumWords);
+    }
+
+    /**
+     Bits set where the pixel at x-1 is set.
+     */
+    static Word shiftedLeft(const Word* pRow, size_t pIndex)
+    {
+        return (pRow[pIndex] << 1) | (pIndex > 0 ? pRow[pIndex - 1] >> (PackedBinaryImage::cBitsPerWord - 1) : 0);
+    }
+
+    /**
+     Bits set where the pixel at x+1 is set.
+     */
+    static Word shiftedRight(const Word* pRow, size_t pIndex, size_t pNumWords)
+    {
+        return (pRow[pIndex] >> 1) | (pIndex + 1 < pNumWords ? pRow[pIndex + 1] << (PackedBinaryImage::cBitsPerWord - 1) : 0);
+    }
+
+    Word all() const
+    {
+        return p2 & p3 & p4 & p5 & p6 & p7 & p8 & p9;
+    }
+
+    Word any() const
+    {
+        return p2 | p3 | p4 | p5 | p6 | p7 | p8 | p9;
+    }
+
+    /**
+     Bits set where at least two of the neighbours are set.
+     */
+    Word atLeastTwo() const
+    {
+        Word lOne = 0;
+        Word lTwo = 0;
+        for (Word lBit : {p2, p3, p4, p5, p6, p7, p8, p9})
+        {
+            lTwo |= lOne & lBit;
+            lOne |= lBit;
+        }
+        return lTwo;
+    }
+
+    /**
+     Bits set where at least two of the neighbours are cleared.
+     */
+    Word atLeastTwoCleared() const
+    {
+        Word lOne = 0;
+        Word lTwo = 0;
+        for (Word lBit : {p2, p3, p4, p5, p6, p7, p8, p9})
+        {
+            lTwo |= lOne & ~lBit;
+            lOne |= ~lBit;
+        }
+        return lTwo;
+    }
+
+    /**
+     Bits set where there is exactly one 0 -> 1 transition in the sequence p2, p3, ..., p9, p2.
+     */
+    Word singleTransition() const
+    {
+        Word lOne = 0;
+        Word lTwo = 0;
+        for (Word lTransition : {~p2 & p3, ~p3 & p4, ~p4 & p5, ~p5 & p6, ~p6 & p7, ~p7 & p8, ~p8 & p9, ~p9 & p2})
+        {
+            lTwo |= lOne & lTransition;
+            lOne |= lTransition;
+        }
+        return lOne & ~lTwo;
+    }
+};
+
+namespace MorphOps
+{
+    /**
+     Smallest amount of words processed by a task, so that small images stay on the calling thread.
+     */
+    static const size_t cMinWordsPerBand = 4096;
+
+    /**
+     Calls pFunction(first, last) for consecutive bands of rows [first, last) covering [0, pNumRows), in parallel on
+     the thread pool. The bands must not write to the rows of the others.
+     */
+    template <typename Function>
+    static void forEachRowBand(size_t pNumRows, size_t pWordsPerRow, Function pFunction)
+    {
+        ThreadPool& lPool = ThreadPool::getInstance();
+        const size_t cMaxBands = 4 * (size_t)lPool.getNumThreads();
+        const size_t cNumBands = std::max<size_t>(1, std::min(cMaxBands, pNumRows * pWordsPerRow / cMinWordsPerBand));
+        const size_t cRowsPerBand = (pNumRows + cNumBands - 1) / cNumBands;
+        if (cNumBands == 1)
+        {
+            pFunction(size_t(0), pNumRows);
+            return;
+        }
+        lPool.parallelFor(0, (int)cNumBands, [&](int pBand) {
+            const size_t lFirst = std::min(pNumRows, pBand * cRowsPerBand);
+            const size_t lLast = std::min(pNumRows, lFirst + cRowsPerBand);
+            if (lFirst != lLast)
+            {
+                pFunction(lFirst, lLast);
+            }
+        });
+    }
+
+    /**
+     Bit-parallel version of the morphological operators: every operator evaluates the 64 neighbourhoods of a row word
+     at once and gives the same result as its BinaryImage counterpart.
+     The rows are processed by bands in parallel, a band reading the row above and the row below it from the
+     unchanged source.
+     */
+    template <typename Operator>
+    static void forEachPackedNeighbourhood(const PackedBinaryImage& pSrc, PackedBinaryImage& pDst, Operator pOperator)
+    {
+        typedef PackedBinaryImage::Word Word;
+        const size_t cNumWords = pSrc.getWordsPerRow();
+        const size_t cHeight = pSrc.getHeight();
+        const std::vector<Word> lEmptyRow(cNumWords, 0);
+        forEachRowBand(cHeight, cNumWords, [&](size_t pFirst, size_t pLast) {
+            for (size_t y = pFirst ; y < pLast ; ++y)
+            {
+                const Word* lAbove = (y > 0) ? pSrc.getRow(y - 1) : lEmptyRow.data();
+                const Word* lRow = pSrc.getRow(y);
+                const Word* lBelow = (y + 1 < cHeight) ? pSrc.getRow(y + 1) : lEmptyRow.data();
+                Word* lDstRow = pDst.getRow(y);
+                for (size_t k = 0 ; k != cNumWords ; ++k)
+                {
+                    lDstRow[k] = pOperator(lRow[k], PackedNeighbourhood(lAbove, lRow, lBelow, k, cNumWords), y, k);
+                }
+            }
+        });
+    }
+
+    /**
+     Pixels of the word c removed by the given Zhang-Suen subiteration (0 or 1)
+     */
+    static PackedBinaryImage::Word thinningRemoved(PackedBinaryImage::Word c, const PackedNeighbourhood& n, int pSubiteration)
+    {
+        typedef PackedBinaryImage::Word Word;
+        Word lConditionsCD = (pSubiteration == 0)
+                           ? ~(n.p2 & n.p4 & n.p6) & ~(n.p4 & n.p6 & n.p8)
+                           : ~(n.p2 & n.p4 & n.p8) & ~(n.p2 & n.p6 & n.p8);
+        return c & n.atLeastTwo() & n.atLeastTwoCleared() & n.singleTransition() & lConditionsCD;
+    }
+
+    static void thin(PackedBinaryImage& pImage)
+    {
+        typedef PackedBinaryImage::Word Word;
+        PackedBinaryImage lThinned(pImage.getWidth(), pImage.getHeight());
+
+        // Pass 1
+        forEachPackedNeighbourhood(pImage, lThinned, [](Word c, const PackedNeighbourhood& n, size_t, size_t) {
+            return c & ~thinningRemoved(c, n, 0);
+        });
+
+        // Pass 2
+        forEachPackedNeighbourhood(lThinned, pImage, [](Word c, const PackedNeighbourhood& n, size_t, size_t) {
+            return c & ~thinningRemoved(c, n, 1);
+        });
+    }
+
+    static const int cUntilConvergence = -1;
+
+    /**
+     Incremental thinning, same as pIterations calls to thin(), or as many as needed to reach a skeleton with
+     cUntilConvergence.
+     After the first iteration, a subiteration only evaluates the words next to a word changed by one of the two
+     previous subiterations: the other ones were already evaluated with the same table and the same neighbourhood.
+     The cost is thus proportional to the number of removed pixels rather than to the image area.
+     Returns the number of iterations that removed pixels.
+     */
+    static int thin(PackedBinaryImage& pImage, int pIterations)
+    {
+        typedef PackedBinaryImage::Word Word;
+        // a word is designated by its row and its index in the row
+        typedef std::pair<size_t, size_t> WordPosition;
+        const size_t cNumWords = pImage.getWordsPerRow();
+        const size_t cHeight = pImage.getHeight();
+        const std::vector<Word> lEmptyRow(cNumWords, 0);
+
+        std::vector<WordPosition> lCandidates;
+        std::vector<std::pair<WordPosition, Word>> lUpdates;
+        std::vector<std::vector<std::pair<WordPosition, Word>>> lChunkUpdates(4 * ThreadPool::getInstance().getNumThreads());
+        std::vector<WordPosition> lChanged[2];
+        std::vector<unsigned> lStamps(pImage.getNumWords(), 0);
+
+        int lIterations = 0;
+        int lSubiterationsWithoutChange = 0;
+        bool lIterationChanged = false;
+        for (unsigned s = 0 ; pIterations < 0 || s < 2u * (unsigned)pIterations ; ++s)
+        {
+            const int cSubiteration = s % 2;
+
+            // words to evaluate
+            lCandidates.clear();
+            if (s < 2)
+            {
+                for (size_t y = 0 ; y != cHeight ; ++y)
+                {
+                    for (size_t k = 0 ; k != cNumWords ; ++k)
+                    {
+                        if (pImage.getRow(y)[k] != 0)
+                        {
+                            lCandidates.push_back(WordPosition(y, k));
+                        }
+                    }
+                }
+            }
+            else
+            {
+                for (const auto& lList : lChanged)
+                {
+                    for (const WordPosition& lPosition : lList)
+                    {
+                        const size_t lLastY = std::min(lPosition.first + 1, cHeight - 1);
+                        const size_t lLastK = std::min(lPosition.second + 1, cNumWords - 1);
+                        for (size_t y = (lPosition.first > 0 ? lPosition.first - 1 : 0) ; y <= lLastY ; ++y)
+                        {
+                            for (size_t k = (lPosition.second > 0 ? lPosition.second - 1 : 0) ; k <= lLastK ; ++k)
+                            {
+                                unsigned& lStamp = lStamps[y * cNumWords + k];
+                                if (lStamp != s && pImage.getRow(y)[k] != 0)
+                                {
+                                    lStamp = s;
+                                    lCandidates.push_back(WordPosition(y, k));
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            // evaluate all of them before changing anything, by chunks in parallel, the updates of the chunks being
+            // concatenated in order
+            const size_t cNumChunks = std::max<size_t>(1, std::min<size_t>(lChunkUpdates.size(), lCandidates.size() / cMinWordsPerBand));
+            const size_t cChunkSize = (lCandidates.size() + cNumChunks - 1) / cNumChunks;
+            ThreadPool::getInstance().parallelFor(0, (int)cNumChunks, [&](int pChunk) {
+                std::vector<std::pair<WordPosition, Word>>& lChunk = lChunkUpdates[pChunk];
+                lChunk.clear();
+                const size_t lFirst = std::min(lCandidates.size(), pChunk * cChunkSize);
+                const size_t lLast = std::min(lCandidates.size(), lFirst + cChunkSize);
+                for (size_t u = lFirst ; u != lLast ; ++u)
+                {
+                    const size_t y = lCandidates[u].first;
+                    const size_t k = lCandidates[u].second;
+                    const Word* lAbove = (y > 0) ? pImage.getRow(y - 1) : lEmptyRow.data();
+                    const Word* lRow = pImage.getRow(y);
+                    const Word* lBelow = (y + 1 < cHeight) ? pImage.getRow(y + 1) : lEmptyRow.data();
+                    Word lRemoved = thinningRemoved(lRow[k], PackedNeighbourhood(lAbove, lRow, lBelow, k, cNumWords), cSubiteration);
+                    if (lRemoved != 0)
+                    {
+                        lChunk.push_back(std::make_pair(lCandidates[u], lRow[k] & ~lRemoved));
+                    }
+                }
+            });
+            lUpdates.clear();
+            for (size_t c = 0 ; c != cNumChunks ; ++c)
+            {
+                lUpdates.insert(lUpdates.end(), lChunkUpdates[c].begin(), lChunkUpdates[c].end());
+            }
+
+            lChanged[cSubiteration].clear();
+            for (const auto& lUpdate : lUpdates)
+            {
+                pImage.getRow(lUpdate.first.first)[lUpdate.first.second] = lUpdate.second;
+                lChanged[cSubiteration].push_back(lUpdate.first);
+            }
+
+            lIterationChanged = lIterationChanged || ! lUpdates.empty();
+            if (cSubiteration == 1)
+            {
+                lIterations += lIterationChanged ? 1 : 0;
+                lIterationChanged = false;
+            }
+            lSubiterationsWithoutChange = lUpdates.empty() ? lSubiterationsWithoutChange + 1 : 0;
+            if (lSubiterationsWithoutChange == 2)
+            {
+                break;
+            }
+        }
+        return lIterations + (lIterationChanged ? 1 : 0);
+    }
+
+    inline void erode(PackedBinaryImage& pImage)
+    {
+        typedef PackedBinaryImage::Word Word;
+        PackedBinaryImage lEroded(pImage.getWidth(), pImage.getHeight());
+        forEachPackedNeighbourhood(pImage, lEroded, [](Word c, const PackedNeighbourhood& n, size_t, size_t) {
+            return c & n.all();
+        });
+        pImage.swap(lEroded);
+    }
+
+    /**
+     Subtract the border of a binary image and return this border
+     */
+    static PackedBinaryImage removeBorder(PackedBinaryImage& pImage)
+    {
+        typedef PackedBinaryImage::Word Word;
+        PackedBinaryImage lReturn(pImage.getWidth(), pImage.getHeight());
+        forEachPackedNeighbourhood(pImage, lReturn, [](Word c, const PackedNeighbourhood& n, size_t, size_t) {
+            return c & ~(n.p2 & n.p4 & n.p6 & n.p8);
+        });
+        // everything that is at the border of the image is a border, and the 4-neighbours of the image border are
+        // background, so that what remains is exactly the pixels whose 4-neighbours are all set
+        PackedBinaryImage lRemaining(pImage.getWidth(), pImage.getHeight());
+        forEachPackedNeighbourhood(pImage, lRemaining, [](Word c, const PackedNeighbourhood& n, size_t, size_t) {
+            return c & n.p2 & n.p4 & n.p6 & n.p8;
+        });
+        pImage.swap(lRemaining);
+        return lReturn;
+    }
+
+    /**
+     Fills isolated holes and removes isolated pixels, leaving the image border untouched.
+     Such a change never alters the decision for a neighbouring pixel, so the word-parallel evaluation gives
+     the same result as the in-place raster scan of the BinaryImage version.
+     */
+    static void median(PackedBinaryImage& pSrcDst)
+    {
+        typedef PackedBinaryImage::Word Word;
+        const size_t cWidth = pSrcDst.getWidth();
+        const size_t cHeight = pSrcDst.getHeight();
+        const size_t cNumWords = pSrcDst.getWordsPerRow();
+        if (cWidth < 3 || cHeight < 3)
+        {
+            return;
+        }
+
+        // columns 1 to width - 2
+        std::vector<Word> lInnerColumns(cNumWords, ~Word(0));
+        lInnerColumns.front() &= ~Word(1);
+        lInnerColumns.back() &= pSrcDst.getLastWordMask();
+        lInnerColumns[(cWidth - 1) / PackedBinaryImage::cBitsPerWord] &= ~(Word(1) << ((cWidth - 1) % PackedBinaryImage::cBitsPerWord));
+
+        PackedBinaryImage lMedian(cWidth, cHeight);
+        forEachPackedNeighbourhood(pSrcDst, lMedian, [&](Word c, const PackedNeighbourhood& n, size_t y, size_t k) {
+            if (y == 0 || y == cHeight - 1)
+            {
+                return c;
+            }
+            Word lHoles = ~c & n.all() & lInnerColumns[k];
+            Word lIsolated = c & ~n.any() & lInnerColumns[k];
+            return (c | lHoles) & ~lIsolated;
+        });
+        pSrcDst.swap(lMedian);
+    }
+
+    /**
+     Keep the pixels on diagonal lines spaced by pStepPixels, like the BinaryImage version.
+     */
+    static PackedBinaryImage diagonal(const PackedBinaryImage& pSrc, int pStepPixels, bool pDirection)
+    {
+        typedef PackedBinaryImage::Word Word;
+        const int cWidth = (int)pSrc.getWidth();
+        const int cHeight = (int)pSrc.getHeight();
+        PackedBinaryImage lDst(pSrc.getWidth(), pSrc.getHeight());
+        for (int y = 0 ; y < cHeight ; ++y)
+        {
+            // down: x - y is a multiple of the step, up: x + y - (height - 1) is a multiple of the step
+            int lPhase = pDirection ? (y % pStepPixels) : ((cHeight - 1 - y) % pStepPixels);
+            const Word* lSrcRow = pSrc.getRow(y);
+            Word* lDstRow = lDst.getRow(y);
+            for (int x = lPhase ; x < cWidth ; x += pStepPixels)
+            {
+                lDstRow[x / PackedBinaryImage::cBitsPerWord] |= lSrcRow[x / PackedBinaryImage::cBitsPerWord] & (Word(1) << (x % PackedBinaryImage::cBitsPerWord));
+            }
+        }
+        return lDst;
+    }
+}
+
+}
+
+#endif
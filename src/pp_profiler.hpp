@@ -0,0 +1,289 @@
+#ifndef PP_PROFILER_HPP_INCLUDED
+#define PP_PROFILER_HPP_INCLUDED
+
+/**
+ @file      pp_profiler.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace PP
+{
+
+/**
+ Record of the time spent in the stages of the compilation, with figures on what every stage processed, to find where
+ the time of a job goes and which inputs are pathological.
+ A stage is timed by a Scope, which records nothing unless the profiler was started: the stages are instrumented at no
+ cost otherwise, and the figures that cost something to get are only computed if the scope isEnabled().
+ */
+class Profiler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     A stage timed on a thread, with its figures.
+     */
+    struct Event
+    {
+        const char* mName = nullptr;
+        int mThread = 0;
+        Clock::time_point mStart;
+        Clock::time_point mEnd;
+        std::vector<std::pair<const char*, double>> mCounters;
+    };
+
+    /**
+     Times the stage pName from its construction to its destruction.
+     */
+    class Scope
+    {
+    public:
+        explicit Scope(const char* pName)
+        : mEnabled(getInstance().isEnabled())
+        {
+            if (mEnabled)
+            {
+                mEvent.mName = pName;
+                mEvent.mThread = getInstance().getThreadIndex();
+                mEvent.mStart = Clock::now();
+            }
+        }
+
+        ~Scope()
+        {
+            if (mEnabled)
+            {
+                mEvent.mEnd = Clock::now();
+                getInstance().add(std::move(mEvent));
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator =(const Scope&) = delete;
+
+        bool isEnabled() const
+        {
+            return mEnabled;
+        }
+
+        /**
+         Sets the figure pCounter of the stage, a count of pixels, points, strokes, passes or bytes.
+         */
+        void count(const char* pCounter, double pValue)
+        {
+            if (mEnabled)
+            {
+                mEvent.mCounters.push_back({pCounter, pValue});
+            }
+        }
+
+    private:
+        const bool mEnabled;
+        Event mEvent;
+    };
+
+    static Profiler& getInstance()
+    {
+        static Profiler sInstance;
+        return sInstance;
+    }
+
+    /**
+     Forgets the stages recorded so far and records the next ones.
+     */
+    void start()
+    {
+        std::lock_guard<std::mutex> lLock(mMutex);
+        mEvents.clear();
+        mStart = Clock::now();
+        mEnabled = true;
+    }
+
+    bool isEnabled() const
+    {
+        return mEnabled;
+    }
+
+    /**
+     Peak resident set size of the process, in bytes, 0 if unknown.
+     */
+    static size_t getPeakRSSBytes()
+    {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS lCounters;
+        return GetProcessMemoryInfo(GetCurrentProcess(), &lCounters, sizeof(lCounters)) ? lCounters.PeakWorkingSetSize : 0;
+#else
+        struct rusage lUsage;
+        if (getrusage(RUSAGE_SELF, &lUsage) != 0)
+        {
+            return 0;
+        }
+#if defined(__APPLE__)
+        return (size_t)lUsage.ru_maxrss;
+#else
+        return (size_t)lUsage.ru_maxrss * 1024;
+#endif
+#endif
+    }
+
+    /**
+     Writes to pPath the wall time since start() and the peak resident set size, the total time, calls and figures of
+     every stage, then every stage recorded with its thread, start time, duration and figures.
+     Returns false if it could not be written.
+     */
+    bool writeProfile(const std::string& pPath) const
+    {
+        std::lock_guard<std::mutex> lLock(mMutex);
+        struct Total
+        {
+            int mCalls = 0;
+            double mTotalMS = 0.;
+            double mMaxMS = 0.;
+            std::map<std::string, double> mCounters;
+        };
+        std::map<std::string, Total> lTotals;
+        QJsonArray lEvents;
+        for (const Event& lEvent : mEvents)
+        {
+            const double cDurationMS = getMS(lEvent.mStart, lEvent.mEnd);
+            Total& lTotal = lTotals[lEvent.mName];
+            ++lTotal.mCalls;
+            lTotal.mTotalMS += cDurationMS;
+            lTotal.mMaxMS = std::max(lTotal.mMaxMS, cDurationMS);
+            QJsonObject lCounters;
+            for (const auto& lCounter : lEvent.mCounters)
+            {
+                lTotal.mCounters[lCounter.first] += lCounter.second;
+                lCounters.insert(lCounter.first, lCounter.second);
+            }
+            QJsonObject lJsonEvent;
+            lJsonEvent.insert("stage", lEvent.mName);
+            lJsonEvent.insert("thread", lEvent.mThread);
+            lJsonEvent.insert("startMS", getMS(mStart, lEvent.mStart));
+            lJsonEvent.insert("durationMS", cDurationMS);
+            lJsonEvent.insert("counters", lCounters);
+            lEvents.append(lJsonEvent);
+        }
+        QJsonObject lStages;
+        for (const auto& lTotal : lTotals)
+        {
+            QJsonObject lCounters;
+            for (const auto& lCounter : lTotal.second.mCounters)
+            {
+                lCounters.insert(QString::fromStdString(lCounter.first), lCounter.second);
+            }
+            QJsonObject lStage;
+            lStage.insert("calls", lTotal.second.mCalls);
+            lStage.insert("totalMS", lTotal.second.mTotalMS);
+            lStage.insert("maxMS", lTotal.second.mMaxMS);
+            lStage.insert("counters", lCounters);
+            lStages.insert(QString::fromStdString(lTotal.first), lStage);
+        }
+        QJsonObject lProfile;
+        lProfile.insert("wallTimeMS", getMS(mStart, Clock::now()));
+        lProfile.insert("peakRSSBytes", (double)getPeakRSSBytes());
+        lProfile.insert("stages", lStages);
+        lProfile.insert("events", lEvents);
+        return write(pPath, QJsonDocument(lProfile));
+    }
+
+    /**
+     Writes the stages recorded so far to pPath in the trace event format of the Chrome tracing tools, every thread
+     having its own track. Returns false if it could not be written.
+     */
+    bool writeTrace(const std::string& pPath) const
+    {
+        std::lock_guard<std::mutex> lLock(mMutex);
+        QJsonArray lEvents;
+        for (const Event& lEvent : mEvents)
+        {
+            QJsonObject lArgs;
+            for (const auto& lCounter : lEvent.mCounters)
+            {
+                lArgs.insert(lCounter.first, lCounter.second);
+            }
+            QJsonObject lJsonEvent;
+            lJsonEvent.insert("name", lEvent.mName);
+            lJsonEvent.insert("cat", "PaintPrint");
+            lJsonEvent.insert("ph", "X");
+            lJsonEvent.insert("ts", getMS(mStart, lEvent.mStart) * 1000.);
+            lJsonEvent.insert("dur", getMS(lEvent.mStart, lEvent.mEnd) * 1000.);
+            lJsonEvent.insert("pid", 1);
+            lJsonEvent.insert("tid", lEvent.mThread);
+            lJsonEvent.insert("args", lArgs);
+            lEvents.append(lJsonEvent);
+        }
+        QJsonObject lTrace;
+        lTrace.insert("traceEvents", lEvents);
+        lTrace.insert("displayTimeUnit", "ms");
+        return write(pPath, QJsonDocument(lTrace));
+    }
+
+private:
+    Profiler()
+    : mStart(Clock::now())
+    {
+    }
+
+    /**
+     Small number naming the calling thread, in the order the threads recorded their first stage.
+     */
+    int getThreadIndex()
+    {
+        std::lock_guard<std::mutex> lLock(mMutex);
+        return mThreads.insert({std::this_thread::get_id(), (int)mThreads.size()}).first->second;
+    }
+
+    void add(Event&& pEvent)
+    {
+        std::lock_guard<std::mutex> lLock(mMutex);
+        mEvents.push_back(std::move(pEvent));
+    }
+
+    static double getMS(Clock::time_point pFrom, Clock::time_point pTo)
+    {
+        return std::chrono::duration<double, std::milli>(pTo - pFrom).count();
+    }
+
+    static bool write(const std::string& pPath, const QJsonDocument& pDocument)
+    {
+        QSaveFile lFile(QString::fromStdString(pPath));
+        return lFile.open(QIODevice::WriteOnly) && lFile.write(pDocument.toJson()) >= 0 && lFile.commit();
+    }
+
+    mutable std::mutex mMutex;
+    std::atomic<bool> mEnabled{false};
+    Clock::time_point mStart;
+    std::vector<Event> mEvents;
+    std::map<std::thread::id, int> mThreads;
+};
+
+}
+
+#endif
@@ -7,11 +7,20 @@
  @date      2017-2018
  */
 
+#include "pp_gcodestream.hpp"
+#include "pp_gcodewriter.hpp"
 #include "pp_tool.hpp"
 #include "pp_layermorph.hpp"
+#include "pp_profiler.hpp"
+#include "pp_stage.hpp"
+#include "pp_threadpool.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <sstream>
+#include <tuple>
 
 namespace PP
 {
@@ -27,17 +36,21 @@ public:
     {
     }
     
-    void setImagePath(std::string pImagePath)
+    /**
+     Returns false if the image could not be loaded.
+     */
+    bool setImagePath(std::string pImagePath)
     {
         mImageFilePath = pImagePath;
-        loadImage(mImageFilePath);
+        return loadImage(mImageFilePath);
     }
     
-    void loadImage(std::string pPath)
+    bool loadImage(std::string pPath)
     {
         QImage lImage;
-        lImage.load(pPath.c_str());
+        const bool lLoaded = lImage.load(pPath.c_str());
         setImage(lImage);
+        return lLoaded;
     }
     
     void setImage(QImage pImage)
@@ -61,39 +74,106 @@ public:
         mTool = pTool;
     }
 
-    void addLayer(float pThreshold)
+    void addLayer(float pThreshold, LayerMorph::FillMode pFillMode = LayerMorph::eHatchFill)
     {
-        mLayers.push_back(LayerMorph(pThreshold));
+        mLayers.push_back(LayerMorph(pThreshold, pFillMode));
+        mLayers.back().setHatchDirection(mLayers.size() % 2 == 0);
+        mLayers.back().setOrderingTimeBudgetMS(mOrderingTimeBudgetMS);
+        mLayers.back().setSimplificationTolerance(mSimplificationTolerance);
+        mLayers.back().setCurveFitting(mCurveFitting);
+        mLayers.back().setCacheDirectory(mCacheDirectory);
+        mLayers.back().setKeepsGCode(mKeepsGCode);
     }
 
-    void compileProject()
+    /**
+     Changes the threshold of a layer, after which only that layer has to be traced again.
+     */
+    void setLayerThreshold(int pIndex, float pThreshold)
     {
-        std::string lPath = mSaveRootPath + ".gcode";
-        std::ofstream lGCodeFile;
-        lGCodeFile.open (lPath);
-        lGCodeFile << "(GCode file generated by PaintPrint)" << std::endl;
+        assert(pIndex >= 0);
+        assert(pIndex < (int)mLayers.size());
+        mLayers[pIndex].setThreshold(pThreshold);
+    }
+
+    /**
+     Writes the G-code of all the layers to <save root>.gcode. If the save root is "-", or if <save root>.gcode is a
+     named pipe, it is streamed instead, every layer being written as soon as it and the layers before it are ready.
+     Returns false if it could not be written.
+     */
+    bool compileProject()
+    {
+        Profiler::Scope lScope("compile project");
+        lScope.count("layers", mLayers.size());
+        const std::string lPath = (mSaveRootPath == "-") ? mSaveRootPath : mSaveRootPath + ".gcode";
+        std::unique_ptr<GCodeStream> lStream;
+        if (GCodeStream::isStream(lPath))
+        {
+            lStream.reset(new GCodeStream(lPath));
+            if (!lStream->isGood())
+            {
+                return false;
+            }
+        }
+
+        GCodeWriter lGCode(mGCodeDecimals);
+        lGCode.comment("GCode file generated by PaintPrint");
         // TODO: add date
-        
-#if 1
-        int i = 0;
-        for (const auto& lLayer : mLayers)
+        if (lStream)
         {
-            ++i;
-            lGCodeFile << "(LAYER " << i << ")" << std::endl;
-            lLayer.compile(mImage, mPrintAreaXMM, mPrintAreaYMM, mWidthMM, mTool, lGCodeFile);
+            lStream->put(0, lGCode.takeChunks());
+            lStream->close(0);
         }
-#else
-        // reverse
-        int i = 0;
-        for (auto lIt = mLayers.rbegin() ; lIt != mLayers.rend() ; ++lIt)
+
+        // order in which the layers are written
+        std::vector<size_t> lOrder;
+        for (size_t i = 0 ; i != mLayers.size() ; ++i)
         {
-            ++i;
-            lGCodeFile << "(LAYER " << i << ")" << std::endl;
-            lIt->compile(mImage, mPrintAreaXMM, mPrintAreaYMM, mWidthMM, mTool, lGCodeFile);
+            lOrder.push_back(i);
         }
+#if 0
+        // reverse
+        std::reverse(lOrder.begin(), lOrder.end());
 #endif
-        
-        lGCodeFile.close();
+
+        // layers are compiled concurrently into their own writer, whose section of the stream follows the header
+        std::vector<GCodeWriter> lLayersGCode(mLayers.size(), GCodeWriter(mGCodeDecimals));
+        std::vector<size_t> lSections(mLayers.size());
+        for (size_t i = 0 ; i != lOrder.size() ; ++i)
+        {
+            GCodeWriter& lLayerGCode = lLayersGCode[lOrder[i]];
+            lSections[lOrder[i]] = i + 1;
+            lLayerGCode.comment("LAYER " + std::to_string(i + 1));
+            if (lStream)
+            {
+                GCodeStream* lLayerStream = lStream.get();
+                lLayerGCode.setSink([lLayerStream, i](std::vector<std::string>&& pChunks) {
+                    lLayerStream->put(i + 1, std::move(pChunks));
+                });
+            }
+        }
+        const std::shared_ptr<const ThresholdBands> lBands = getBands();
+        mLayersStatistics.assign(mLayers.size(), LayerStatistics());
+        ThreadPool::getInstance().parallelFor(0, (int)mLayers.size(), [&](int pIndex) {
+            mLayers[pIndex].compile(*lBands, mPrintAreaXMM, mPrintAreaYMM, mWidthMM, mTool, lLayersGCode[pIndex], mLayersStatistics[pIndex]);
+            if (lStream)
+            {
+                lLayersGCode[pIndex].flush();
+                lStream->close(lSections[pIndex]);
+            }
+        });
+        if (lStream)
+        {
+            return lStream->isGood();
+        }
+
+        // otherwise appended in order and written at once
+        for (size_t lIndex : lOrder)
+        {
+            lGCode.append(std::move(lLayersGCode[lIndex]));
+        }
+        Profiler::Scope lWriteScope("write G-code");
+        lWriteScope.count("bytes", lGCode.getSize());
+        return lGCode.write(lPath);
     }
     
     float getWidthMM() const
@@ -106,6 +186,85 @@ public:
         mWidthMM = pWidthMM;
     }
 
+    /**
+     Time spent improving the order of the strokes of every refill batch, in milliseconds, 0 for no limit but the
+     number of passes of StrokeOrder, which keeps the G-code the same on any machine.
+     */
+    void setOrderingTimeBudgetMS(float pOrderingTimeBudgetMS)
+    {
+        mOrderingTimeBudgetMS = pOrderingTimeBudgetMS;
+        for (auto& lLayer : mLayers)
+        {
+            lLayer.setOrderingTimeBudgetMS(pOrderingTimeBudgetMS);
+        }
+    }
+
+    /**
+     Distance to the traced strokes within which they are simplified, as a fraction of the width of the tool, 0 for
+     no simplification.
+     */
+    void setSimplificationTolerance(float pSimplificationTolerance)
+    {
+        mSimplificationTolerance = pSimplificationTolerance;
+        for (auto& lLayer : mLayers)
+        {
+            lLayer.setSimplificationTolerance(pSimplificationTolerance);
+        }
+    }
+
+    /**
+     Moves the strokes are fitted with, arcs and cubic curves being output only if the firmware supports them.
+     */
+    void setCurveFitting(CurveFitter::Mode pCurveFitting)
+    {
+        mCurveFitting = pCurveFitting;
+        for (auto& lLayer : mLayers)
+        {
+            lLayer.setCurveFitting(pCurveFitting);
+        }
+    }
+
+    /**
+     Directory of the on-disk cache of the traced layers, none if empty.
+     */
+    void setCacheDirectory(const std::string& pCacheDirectory)
+    {
+        mCacheDirectory = pCacheDirectory;
+        for (auto& lLayer : mLayers)
+        {
+            lLayer.setCacheDirectory(pCacheDirectory);
+        }
+    }
+
+    /**
+     Whether the layers keep the text of their G-code, so that compiling the project again after changing some layers
+     only emits those, at the cost of keeping all the text in memory. Not worth it for a single compilation.
+     */
+    void setKeepsGCode(bool pKeepsGCode)
+    {
+        mKeepsGCode = pKeepsGCode;
+        for (auto& lLayer : mLayers)
+        {
+            lLayer.setKeepsGCode(pKeepsGCode);
+        }
+    }
+
+    /**
+     Number of decimals of the coordinates in the G-code.
+     */
+    void setGCodeDecimals(int pGCodeDecimals)
+    {
+        mGCodeDecimals = pGCodeDecimals;
+    }
+
+    /**
+     Figures of the layers, as of the last compileProject().
+     */
+    const std::vector<LayerStatistics>& getLayersStatistics() const
+    {
+        return mLayersStatistics;
+    }
+
     void setPrintArea(float pPrintAreaXMM, float pPrintAreaYMM)
     {
         mPrintAreaXMM = pPrintAreaXMM;
@@ -115,13 +274,15 @@ public:
     // Update the preview images of all layers, plus blends an image for the selected level
     void updatePreview(float pLevel = 1.f) const
     {
+        Profiler::Scope lScope("blend preview");
         mPreview.fill(Qt::white);
         
+        const std::shared_ptr<const ThresholdBands> lBands = getBands();
         float lNumLayers = mLayers.size();
         float lLimit = lNumLayers * pLevel;
         for (int i = 0 ; i < (int)std::min(lNumLayers, lLimit) ; ++i)
         {
-            mLayers[i].blendPreview(mImage, mPreview, mTool, mWidthMM);
+            mLayers[i].blendPreview(*lBands, mPreview, mTool, mWidthMM);
         }
     }
 
@@ -134,7 +295,7 @@ public:
     {
         assert(pIndex >= 0);
         assert(pIndex < mLayers.size());
-        return  mLayers[pIndex].essentialize(mImage, mWidthMM, mTool);
+        return  mLayers[pIndex].essentialize(*getBands(), mWidthMM, mTool);
     }
     
     QImage& getPreview()
@@ -143,6 +304,38 @@ public:
     }
     
 private:
+    /**
+     Lightness of the image, computed again when the image changes.
+     */
+    std::shared_ptr<const LightnessImage> getLightness() const
+    {
+        return mLightnessStage.get(mImage.cacheKey(), [&]() {
+            Profiler::Scope lScope("lightness");
+            lScope.count("pixels", (double)mImage.width() * mImage.height());
+            return LightnessImage(mImage);
+        });
+    }
+
+    /**
+     Lightness of the image quantized by the thresholds of all the layers in a single pass, computed again when the
+     image or the thresholds change.
+     */
+    std::shared_ptr<const ThresholdBands> getBands() const
+    {
+        std::vector<float> lThresholds;
+        for (const auto& lLayer : mLayers)
+        {
+            lThresholds.push_back(lLayer.getThreshold());
+        }
+        return mBandsStage.get(std::make_tuple(mImage.cacheKey(), lThresholds), [&]() {
+            const std::shared_ptr<const LightnessImage> lLightness = getLightness();
+            Profiler::Scope lScope("threshold bands");
+            lScope.count("pixels", (double)lLightness->getWidth() * lLightness->getHeight());
+            lScope.count("thresholds", lThresholds.size());
+            return ThresholdBands(*lLightness, lThresholds);
+        });
+    }
+    
     std::string mSaveRootPath;
 
     std::string mProjectFilePath;
@@ -150,10 +343,19 @@ private:
     std::string mImageFilePath;
     
     QImage mImage;
+    mutable Stage<qint64, LightnessImage> mLightnessStage;
+    mutable Stage<std::tuple<qint64, std::vector<float>>, ThresholdBands> mBandsStage;
     std::vector<LayerMorph> mLayers;
     float mPrintAreaXMM = 200.f;
     float mPrintAreaYMM = 200.f;
     float mWidthMM = 80.f;
+    float mOrderingTimeBudgetMS = 0.f;
+    float mSimplificationTolerance = 0.1f;
+    CurveFitter::Mode mCurveFitting = CurveFitter::eLines;
+    int mGCodeDecimals = 3;
+    std::string mCacheDirectory;
+    bool mKeepsGCode = false;
+    std::vector<LayerStatistics> mLayersStatistics;
     
     mutable QImage mPreview;
     
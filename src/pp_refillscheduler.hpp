@@ -0,0 +1,220 @@
+#ifndef PP_REFILLSCHEDULER_HPP_INCLUDED
+#define PP_REFILLSCHEDULER_HPP_INCLUDED
+
+/**
+ @file      pp_refillscheduler.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include "pp_layer.hpp"
+#include "pp_strokeorder.hpp"
+#include "pp_threadpool.hpp"
+#include "pp_tool.hpp"
+#include "pp_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace PP
+{
+
+/**
+ Split of the strokes of a layer into the batches drawn between two refills, and order of the strokes of every batch.
+ All the strokes are first ordered into a single tour from the refill station, which is then cut into batches of
+ neighbouring strokes: the cuts give the fewest refills, and among them the shortest round trips to the station.
+ Every batch then starts with its longest stroke, so that the loaded brush does not drip on a short one, and the others
+ are ordered to go back to the station by the shortest way.
+ A tool that does not need to refill draws all the strokes in a single batch from the origin of the machine.
+ */
+class RefillScheduler
+{
+public:
+    RefillScheduler(const Tool& pTool, float pTimeBudgetMS)
+    : mNeedsRefill(pTool.getNeedsRefill())
+    , mLengthBeforeRefillMM(pTool.getLengthBeforeRefillMM())
+    , mStation({pTool.getRefillStationXMM(), pTool.getRefillStationYMM()})
+    , mTimeBudgetMS(pTimeBudgetMS)
+    {
+    }
+
+    std::vector<std::vector<CombinedPathMM>> schedule(std::vector<CombinedPathMM>& pStrokes, LayerStatistics& pStatistics) const
+    {
+        pStatistics = LayerStatistics();
+        std::vector<std::vector<CombinedPathMM>> lBatches;
+        if (pStrokes.empty())
+        {
+            return lBatches;
+        }
+        if (!mNeedsRefill)
+        {
+            const PointMM cOrigin = {0.f, 0.f};
+            pStatistics.mTravelBeforeMM = StrokeOrder::getTravel(pStrokes, cOrigin);
+            StrokeOrder lOrder(pStrokes, cOrigin);
+            lOrder.improve(mTimeBudgetMS);
+            lOrder.apply(pStrokes);
+            pStatistics.mTravelAfterMM = lOrder.getTravel();
+            lBatches.push_back(std::vector<CombinedPathMM>());
+            lBatches.back().swap(pStrokes);
+            return lBatches;
+        }
+
+        std::vector<float> lLengths;
+        for (const auto& lStroke : pStrokes)
+        {
+            lLengths.push_back(lStroke.length());
+        }
+        pStatistics.mTravelBeforeMM = getTracedOrderTravel(pStrokes, lLengths);
+
+        // single tour, whose strokes keep their length
+        StrokeOrder lTour(pStrokes, mStation, mStation);
+        lTour.improve(mTimeBudgetMS);
+        lTour.apply(pStrokes);
+        std::vector<float> lTourLengths;
+        for (int s : lTour.getTour())
+        {
+            lTourLengths.push_back(lLengths[s]);
+        }
+
+        const std::vector<size_t> lCuts = split(pStrokes, lTourLengths);
+        for (size_t b = 0 ; b + 1 < lCuts.size() ; ++b)
+        {
+            lBatches.push_back(std::vector<CombinedPathMM>(std::make_move_iterator(pStrokes.begin() + lCuts[b]),
+                                                           std::make_move_iterator(pStrokes.begin() + lCuts[b + 1])));
+        }
+        pStrokes.clear();
+
+        std::vector<float> lBatchesTravels(lBatches.size());
+        ThreadPool::getInstance().parallelFor(0, (int)lBatches.size(), [&](int b) {
+            lBatchesTravels[b] = orderBatch(lBatches[b], std::vector<float>(lTourLengths.begin() + lCuts[b],
+                                                                            lTourLengths.begin() + lCuts[b + 1]));
+        });
+        for (float lTravel : lBatchesTravels)
+        {
+            pStatistics.mTravelAfterMM += lTravel;
+        }
+        pStatistics.mNumRefills = (int)lBatches.size();
+        return lBatches;
+    }
+
+private:
+    /**
+     Length accounted for every stroke on top of its own, as each one spills ink.
+     */
+    static constexpr float cSpillMM = 2.f;
+
+    static float getDistance(PointMM a, PointMM b)
+    {
+        return std::hypot(b.mX - a.mX, b.mY - a.mY);
+    }
+
+    /**
+     Travel with the strokes drawn in the order they were traced, a refill being done as soon as the length drawn
+     exceeds the length before refill.
+     */
+    float getTracedOrderTravel(const std::vector<CombinedPathMM>& pStrokes, const std::vector<float>& pLengths) const
+    {
+        float lTravel = 0.f;
+        float lLength = 0.f;
+        PointMM lCurrent = mStation;
+        for (size_t u = 0 ; u != pStrokes.size() ; ++u)
+        {
+            lTravel += getDistance(lCurrent, pStrokes[u].mPoints.front());
+            lCurrent = pStrokes[u].mPoints.back();
+            lLength += pLengths[u] + cSpillMM;
+            if (lLength > mLengthBeforeRefillMM)
+            {
+                lTravel += getDistance(lCurrent, mStation);
+                lCurrent = mStation;
+                lLength = 0.f;
+            }
+        }
+        return lTravel + getDistance(lCurrent, mStation);
+    }
+
+    /**
+     Positions of the cuts of the tour, from 0 to its size, into batches that can be drawn without a refill.
+     The cost of the best split of the first k strokes, as a number of batches then a travel, is the best over the
+     possible last batches of the cost of the strokes before it plus a round trip from the station through it.
+     */
+    std::vector<size_t> split(const std::vector<CombinedPathMM>& pTour, const std::vector<float>& pLengths) const
+    {
+        typedef std::pair<int, float> Cost;
+        const size_t cNumStrokes = pTour.size();
+        std::vector<Cost> lCosts(cNumStrokes + 1, Cost(std::numeric_limits<int>::max(), 0.f));
+        std::vector<size_t> lPrevious(cNumStrokes + 1, 0);
+        lCosts[0] = Cost(0, 0.f);
+        for (size_t lLast = 0 ; lLast != cNumStrokes ; ++lLast)
+        {
+            // batches from lFirst to lLast, growing backwards while the strokes before the last one fit
+            float lLength = 0.f;
+            float lInnerTravel = 0.f;
+            for (size_t lFirst = lLast + 1 ; lFirst-- > 0 ; )
+            {
+                if (lFirst != lLast)
+                {
+                    lLength += pLengths[lFirst] + cSpillMM;
+                    if (lLength > mLengthBeforeRefillMM)
+                    {
+                        break;
+                    }
+                    lInnerTravel += getDistance(pTour[lFirst].mPoints.back(), pTour[lFirst + 1].mPoints.front());
+                }
+                const float lRoundTrip = getDistance(mStation, pTour[lFirst].mPoints.front())
+                        + lInnerTravel + getDistance(pTour[lLast].mPoints.back(), mStation);
+                const Cost lCost(lCosts[lFirst].first + 1, lCosts[lFirst].second + lRoundTrip);
+                if (lCost < lCosts[lLast + 1])
+                {
+                    lCosts[lLast + 1] = lCost;
+                    lPrevious[lLast + 1] = lFirst;
+                }
+            }
+        }
+
+        std::vector<size_t> lCuts(1, cNumStrokes);
+        while (lCuts.back() != 0)
+        {
+            lCuts.push_back(lPrevious[lCuts.back()]);
+        }
+        std::reverse(lCuts.begin(), lCuts.end());
+        return lCuts;
+    }
+
+    /**
+     Puts the longest stroke of a batch first, entered by its end nearest to the station, and orders the others back
+     to the station. Returns the travel of the batch from the station and back.
+     */
+    float orderBatch(std::vector<CombinedPathMM>& pBatch, const std::vector<float>& pLengths) const
+    {
+        const size_t lLongest = std::max_element(pLengths.begin(), pLengths.end()) - pLengths.begin();
+        std::swap(pBatch[0], pBatch[lLongest]);
+        CombinedPathMM& lFirst = pBatch[0];
+        if (getDistance(mStation, lFirst.mPoints.back()) < getDistance(mStation, lFirst.mPoints.front()))
+        {
+            std::reverse(lFirst.mPoints.begin(), lFirst.mPoints.end());
+        }
+
+        std::vector<CombinedPathMM> lOthers(std::make_move_iterator(pBatch.begin() + 1),
+                                            std::make_move_iterator(pBatch.end()));
+        pBatch.resize(1);
+        StrokeOrder lOrder(lOthers, lFirst.mPoints.back(), mStation);
+        lOrder.improve(mTimeBudgetMS);
+        lOrder.apply(lOthers);
+        const float lTravel = getDistance(mStation, lFirst.mPoints.front()) + lOrder.getTravel();
+        pBatch.insert(pBatch.end(), std::make_move_iterator(lOthers.begin()), std::make_move_iterator(lOthers.end()));
+        return lTravel;
+    }
+
+    const bool mNeedsRefill;
+    const float mLengthBeforeRefillMM;
+    const PointMM mStation;
+    const float mTimeBudgetMS;
+};
+
+}
+
+#endif
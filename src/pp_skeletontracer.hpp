@@ -0,0 +1,244 @@
+#ifndef PP_SKELETONTRACER_HPP_INCLUDED
+#define PP_SKELETONTRACER_HPP_INCLUDED
+
+/**
+ @file      pp_skeletontracer.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include "pp_threadpool.hpp"
+#include "pp_utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace PP
+{
+
+/**
+ Graph of a thinned image, whose nodes are the pixels that do not have exactly two neighbours (end points, junctions
+ and isolated pixels), and whose edges are the chains of pixels with two neighbours between them.
+ A diagonal neighbour only counts when none of the two pixels next to both is set, so that the corners of the
+ staircases left by the thinning are not taken for junctions.
+ trace() returns one path per edge, plus one closed path per ring without any node, in a time linear in the number of
+ pixels.
+ */
+class SkeletonTracer
+{
+public:
+    explicit SkeletonTracer(const BinaryImage& pImage)
+    : mImage(pImage)
+    , mWidth((int)pImage.getWidth())
+    , mHeight((int)pImage.getHeight())
+    , mDegrees(pImage.getWidth() * pImage.getHeight(), 0)
+    {
+    }
+
+    std::vector<CombinedPathsPixels> trace()
+    {
+        // every band of rows traces the edges starting from its own nodes: an edge being kept by its end with the
+        // smallest index only, the bands are independent and their concatenation does not depend on the banding
+        ThreadPool& lPool = ThreadPool::getInstance();
+        const int cNumBands = std::max(1, std::min(mHeight, 4 * lPool.getNumThreads()));
+        const int cRowsPerBand = (mHeight + cNumBands - 1) / std::max(1, cNumBands);
+        std::vector<std::vector<CombinedPathsPixels>> lBandsPaths(cNumBands);
+        lPool.parallelFor(0, cNumBands, [&](int pBand) {
+            computeDegrees(pBand * cRowsPerBand, std::min(mHeight, (pBand + 1) * cRowsPerBand));
+        });
+        lPool.parallelFor(0, cNumBands, [&](int pBand) {
+            traceEdges(pBand * cRowsPerBand, std::min(mHeight, (pBand + 1) * cRowsPerBand), lBandsPaths[pBand]);
+        });
+
+        std::vector<CombinedPathsPixels> lPaths;
+        for (auto& lBandPaths : lBandsPaths)
+        {
+            for (auto& lPath : lBandPaths)
+            {
+                lPaths.push_back(CombinedPathsPixels());
+                lPaths.back().mPoints.swap(lPath.mPoints);
+            }
+        }
+
+        traceRings(lPaths);
+        return lPaths;
+    }
+
+private:
+    /**
+     Offsets of the 8 neighbours, in raster order.
+     */
+    static const PointPixel* getNeighbourOffsets()
+    {
+        static const PointPixel sOffsets[8] = {{-1, -1}, {0, -1}, {1, -1}, {-1, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+        return sOffsets;
+    }
+
+    bool isSet(int x, int y) const
+    {
+        return x >= 0 && y >= 0 && x < mWidth && y < mHeight && mImage.getPixel(x, y);
+    }
+
+    /**
+     Whether the neighbour of p at pOffset is set and connected to it.
+     */
+    bool isAdjacent(PointPixel p, PointPixel pOffset) const
+    {
+        if (!isSet(p.mX + pOffset.mX, p.mY + pOffset.mY))
+        {
+            return false;
+        }
+        return pOffset.mX == 0 || pOffset.mY == 0
+            || (!isSet(p.mX + pOffset.mX, p.mY) && !isSet(p.mX, p.mY + pOffset.mY));
+    }
+
+    int getIndex(PointPixel p) const
+    {
+        return p.mY * mWidth + p.mX;
+    }
+
+    bool isNode(PointPixel p) const
+    {
+        return mDegrees[getIndex(p)] != 2;
+    }
+
+    void computeDegrees(int pFirstRow, int pLastRow)
+    {
+        const PointPixel* lOffsets = getNeighbourOffsets();
+        for (int y = pFirstRow ; y < pLastRow ; ++y)
+        {
+            for (int x = 0 ; x != mWidth ; ++x)
+            {
+                uint8_t lDegree = 0;
+                for (int n = 0 ; n != 8 ; ++n)
+                {
+                    lDegree += isAdjacent({x, y}, lOffsets[n]) ? 1 : 0;
+                }
+                mDegrees[y * mWidth + x] = lDegree;
+            }
+        }
+    }
+
+    /**
+     The neighbour of p with two neighbours that is not pPrevious.
+     */
+    PointPixel getNext(PointPixel p, PointPixel pPrevious) const
+    {
+        const PointPixel* lOffsets = getNeighbourOffsets();
+        for (int n = 0 ; n != 8 ; ++n)
+        {
+            const PointPixel q = {p.mX + lOffsets[n].mX, p.mY + lOffsets[n].mY};
+            if (isAdjacent(p, lOffsets[n]) && (q.mX != pPrevious.mX || q.mY != pPrevious.mY))
+            {
+                return q;
+            }
+        }
+        assert(false);
+        return p;
+    }
+
+    /**
+     Follows the chain from the node pStart through its neighbour pFirst up to the next node.
+     */
+    void walk(PointPixel pStart, PointPixel pFirst, std::vector<PointPixel>& pChain) const
+    {
+        pChain.clear();
+        pChain.push_back(pStart);
+        pChain.push_back(pFirst);
+        while (!isNode(pChain.back()))
+        {
+            pChain.push_back(getNext(pChain.back(), pChain[pChain.size() - 2]));
+        }
+    }
+
+    void traceEdges(int pFirstRow, int pLastRow, std::vector<CombinedPathsPixels>& pPaths) const
+    {
+        const PointPixel* lOffsets = getNeighbourOffsets();
+        std::vector<PointPixel> lChain;
+        for (int y = pFirstRow ; y < pLastRow ; ++y)
+        {
+            for (int x = 0 ; x != mWidth ; ++x)
+            {
+                const PointPixel p = {x, y};
+                if (!mImage.getPixel(x, y) || !isNode(p))
+                {
+                    continue;
+                }
+                if (mDegrees[getIndex(p)] == 0)
+                {
+                    pPaths.push_back(CombinedPathsPixels({p}));
+                    continue;
+                }
+                for (int n = 0 ; n != 8 ; ++n)
+                {
+                    const PointPixel q = {x + lOffsets[n].mX, y + lOffsets[n].mY};
+                    if (!isAdjacent(p, lOffsets[n]))
+                    {
+                        continue;
+                    }
+                    walk(p, q, lChain);
+                    // the same edge is walked from its other end: keep the walk starting from the smallest end, or
+                    // for a loop, the one starting with the smallest step
+                    const int lStart = getIndex(lChain.front());
+                    const int lEnd = getIndex(lChain.back());
+                    if (lStart < lEnd || (lStart == lEnd && getIndex(lChain[1]) < getIndex(lChain[lChain.size() - 2])))
+                    {
+                        pPaths.push_back(CombinedPathsPixels());
+                        pPaths.back().mPoints.assign(lChain.begin(), lChain.end());
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     Closed paths for the components made only of pixels with two neighbours, that no edge goes through.
+     */
+    void traceRings(std::vector<CombinedPathsPixels>& pPaths) const
+    {
+        std::vector<bool> lVisited(mDegrees.size(), false);
+        for (const auto& lPath : pPaths)
+        {
+            for (const PointPixel& p : lPath.mPoints)
+            {
+                lVisited[getIndex(p)] = true;
+            }
+        }
+        for (int y = 0 ; y != mHeight ; ++y)
+        {
+            for (int x = 0 ; x != mWidth ; ++x)
+            {
+                const PointPixel p = {x, y};
+                if (!mImage.getPixel(x, y) || lVisited[getIndex(p)])
+                {
+                    continue;
+                }
+                // no node in this component: p has two neighbours and so have all the pixels of its ring
+                CombinedPathsPixels lRing({p});
+                lVisited[getIndex(p)] = true;
+                PointPixel lPrevious = p;
+                PointPixel lCurrent = getNext(p, p);
+                while (lCurrent.mX != p.mX || lCurrent.mY != p.mY)
+                {
+                    lRing.mPoints.push_back(lCurrent);
+                    lVisited[getIndex(lCurrent)] = true;
+                    const PointPixel lNext = getNext(lCurrent, lPrevious);
+                    lPrevious = lCurrent;
+                    lCurrent = lNext;
+                }
+                lRing.mPoints.push_back(p);
+                pPaths.push_back(lRing);
+            }
+        }
+    }
+
+    const BinaryImage& mImage;
+    const int mWidth;
+    const int mHeight;
+    std::vector<uint8_t> mDegrees;
+};
+
+}
+
+#endif
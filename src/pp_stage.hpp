@@ -0,0 +1,116 @@
+#ifndef PP_STAGE_HPP_INCLUDED
+#define PP_STAGE_HPP_INCLUDED
+
+/**
+ @file      pp_stage.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace PP
+{
+
+/**
+ Result of a stage of the compilation, kept with the inputs it was computed from, and computed again only when they
+ change: changing a parameter recomputes the stages whose inputs include it, directly or through the key of a previous
+ stage, and nothing else.
+ The inputs are a key compared with ==. A copy of a stage is empty, as the copied object is usually changed next, while
+ a moved stage keeps its result, so that the layers of a project are not computed again when their vector grows.
+ */
+template <typename Key, typename Value>
+class Stage
+{
+public:
+    Stage() {}
+    Stage(const Stage&) {}
+    Stage& operator =(const Stage&)
+    {
+        reset();
+        return *this;
+    }
+
+    Stage(Stage&& pOther) noexcept
+    {
+        std::lock_guard<std::mutex> lLock(pOther.mMutex);
+        mKey = std::move(pOther.mKey);
+        mValue = std::move(pOther.mValue);
+        mNumComputations = pOther.mNumComputations;
+    }
+
+    Stage& operator =(Stage&& pOther) noexcept
+    {
+        if (this != &pOther)
+        {
+            std::lock(mMutex, pOther.mMutex);
+            std::lock_guard<std::mutex> lLock(mMutex, std::adopt_lock);
+            std::lock_guard<std::mutex> lOtherLock(pOther.mMutex, std::adopt_lock);
+            mKey = std::move(pOther.mKey);
+            mValue = std::move(pOther.mValue);
+            mNumComputations = pOther.mNumComputations;
+        }
+        return *this;
+    }
+
+    /**
+     The result for pKey, computed by pCompute() if the last one was for other inputs. It is computed unlocked, a
+     concurrent computation for the same key giving the same result.
+     */
+    template <typename Compute>
+    std::shared_ptr<const Value> get(const Key& pKey, Compute pCompute)
+    {
+        std::shared_ptr<const Value> lValue = find(pKey);
+        if (!lValue)
+        {
+            lValue = set(pKey, pCompute());
+        }
+        return lValue;
+    }
+
+    /**
+     The result for pKey, null if the last one was for other inputs.
+     */
+    std::shared_ptr<const Value> find(const Key& pKey) const
+    {
+        std::lock_guard<std::mutex> lLock(mMutex);
+        return (mValue && mKey == pKey) ? mValue : std::shared_ptr<const Value>();
+    }
+
+    std::shared_ptr<const Value> set(const Key& pKey, Value pValue)
+    {
+        std::shared_ptr<const Value> lValue = std::make_shared<const Value>(std::move(pValue));
+        std::lock_guard<std::mutex> lLock(mMutex);
+        mKey = pKey;
+        mValue = lValue;
+        ++mNumComputations;
+        return lValue;
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lLock(mMutex);
+        mValue.reset();
+    }
+
+    /**
+     Number of results computed so far.
+     */
+    size_t getNumComputations() const
+    {
+        std::lock_guard<std::mutex> lLock(mMutex);
+        return mNumComputations;
+    }
+
+private:
+    mutable std::mutex mMutex;
+    Key mKey;
+    std::shared_ptr<const Value> mValue;
+    size_t mNumComputations = 0;
+};
+
+}
+
+#endif
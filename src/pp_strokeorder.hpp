@@ -0,0 +1,458 @@
+#ifndef PP_STROKEORDER_HPP_INCLUDED
+#define PP_STROKEORDER_HPP_INCLUDED
+
+/**
+ @file      pp_strokeorder.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include "pp_endpointgrid.hpp"
+#include "pp_utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+namespace PP
+{
+
+/**
+ Order of a set of strokes, each of them possibly reversed, that shortens the pen-up travel from a start point through
+ all of them, and back to an end point if there is one.
+ The tour is seeded by going each time to the nearest stroke end, then improved by 2-opt moves, reversing a run of
+ strokes, and Or-opt moves, moving a run of up to three strokes elsewhere, possibly reversed. Only the moves creating
+ a link between an end and one of its nearest ends are tried, until none shortens the tour, for at most cMaxPasses
+ passes over the strokes so that the order does not depend on the speed of the machine, or until an optional time
+ budget is spent.
+ */
+class StrokeOrder
+{
+public:
+    StrokeOrder(const std::vector<CombinedPathMM>& pStrokes, PointMM pStart)
+    : StrokeOrder(pStrokes, pStart, pStart, false)
+    {
+    }
+
+    StrokeOrder(const std::vector<CombinedPathMM>& pStrokes, PointMM pStart, PointMM pEnd)
+    : StrokeOrder(pStrokes, pStart, pEnd, true)
+    {
+    }
+
+    /**
+     Pen-up travel of the strokes drawn in the given order from pStart.
+     */
+    static float getTravel(const std::vector<CombinedPathMM>& pStrokes, PointMM pStart)
+    {
+        float lTravel = 0.f;
+        PointMM lCurrent = pStart;
+        for (const auto& lStroke : pStrokes)
+        {
+            lTravel += getDistance(lCurrent, lStroke.mPoints.front());
+            lCurrent = lStroke.mPoints.back();
+        }
+        return lTravel;
+    }
+
+    /**
+     Pen-up travel of the strokes drawn in the given order from pStart, then back to pEnd.
+     */
+    static float getTravel(const std::vector<CombinedPathMM>& pStrokes, PointMM pStart, PointMM pEnd)
+    {
+        const PointMM lLast = pStrokes.empty() ? pStart : pStrokes.back().mPoints.back();
+        return getTravel(pStrokes, pStart) + getDistance(lLast, pEnd);
+    }
+
+    float getTravel() const
+    {
+        float lTravel = 0.f;
+        for (int i = 0 ; i <= mNumStrokes ; ++i)
+        {
+            lTravel += getLink(i);
+        }
+        return lTravel;
+    }
+
+    /**
+     Passes over the strokes after which improve() stops even if the tour could still be shortened. Orders of
+     thousands of strokes usually stop improving within 10.
+     */
+    static const int cMaxPasses = 16;
+
+    /**
+     Applies 2-opt and Or-opt moves until none shortens the tour, for at most cMaxPasses passes, or until pTimeBudgetMS
+     milliseconds are spent, a zero budget meaning no limit of time. A time budget makes the order depend on the speed
+     and the load of the machine.
+     */
+    void improve(float pTimeBudgetMS = 0.f)
+    {
+        typedef std::chrono::steady_clock Clock;
+        const Clock::time_point cDeadline = Clock::now()
+                + std::chrono::microseconds((long long)(pTimeBudgetMS * 1000.f));
+        bool lImproved = true;
+        for (int lPass = 0 ; lImproved && lPass != cMaxPasses ; ++lPass)
+        {
+            lImproved = false;
+            for (int s = 0 ; s != mNumStrokes ; ++s)
+            {
+                if (pTimeBudgetMS > 0.f && s % 64 == 0 && Clock::now() > cDeadline)
+                {
+                    return;
+                }
+                while (tryTwoOpt(s) || tryOrOpt(s))
+                {
+                    lImproved = true;
+                }
+            }
+        }
+    }
+
+    /**
+     Indices of the strokes in their order.
+     */
+    const std::vector<int>& getTour() const
+    {
+        return mTour;
+    }
+
+    /**
+     Reorders pStrokes, which must be the strokes the order was computed for, and reverses those that are drawn
+     backwards.
+     */
+    void apply(std::vector<CombinedPathMM>& pStrokes) const
+    {
+        assert((int)pStrokes.size() == mNumStrokes);
+        std::vector<CombinedPathMM> lOrdered(mNumStrokes);
+        for (int i = 0 ; i != mNumStrokes ; ++i)
+        {
+            const int s = mTour[i];
+            lOrdered[i].mPoints.swap(pStrokes[s].mPoints);
+            if (mReversed[s])
+            {
+                std::reverse(lOrdered[i].mPoints.begin(), lOrdered[i].mPoints.end());
+            }
+        }
+        pStrokes.swap(lOrdered);
+    }
+
+private:
+    StrokeOrder(const std::vector<CombinedPathMM>& pStrokes, PointMM pStart, PointMM pEnd, bool pHasEnd)
+    : mStart(pStart)
+    , mEnd(pEnd)
+    , mHasEnd(pHasEnd)
+    , mNumStrokes((int)pStrokes.size())
+    , mTour(mNumStrokes)
+    , mPositions(mNumStrokes)
+    , mReversed(mNumStrokes, false)
+    {
+        for (const auto& lStroke : pStrokes)
+        {
+            mEnds.push_back(lStroke.mPoints.front());
+            mEnds.push_back(lStroke.mPoints.back());
+        }
+        if (mNumStrokes == 0)
+        {
+            return;
+        }
+
+        // about two ends per cell
+        PointMM lMin = {std::min(pStart.mX, pEnd.mX), std::min(pStart.mY, pEnd.mY)};
+        PointMM lMax = {std::max(pStart.mX, pEnd.mX), std::max(pStart.mY, pEnd.mY)};
+        for (PointMM p : mEnds)
+        {
+            lMin = {std::min(lMin.mX, p.mX), std::min(lMin.mY, p.mY)};
+            lMax = {std::max(lMax.mX, p.mX), std::max(lMax.mY, p.mY)};
+        }
+        const float cArea = std::max(lMax.mX - lMin.mX, 1.f) * std::max(lMax.mY - lMin.mY, 1.f);
+        EndpointGrid lGrid(std::sqrt(cArea / mNumStrokes), lMin, lMax);
+        for (int e = 0 ; e != 2 * mNumStrokes ; ++e)
+        {
+            lGrid.insert(e, mEnds[e]);
+        }
+        computeNeighbours(lGrid);
+        seed(lGrid);
+    }
+
+    static const int cNumNeighbours = 8;
+    static const int cMaxRunLength = 3;
+
+    /**
+     Improvements smaller than this are ignored, so that rounding errors cannot make moves cycle.
+     */
+    static constexpr float cMinGainMM = 1e-3f;
+
+    static float getDistance(PointMM a, PointMM b)
+    {
+        const float dx = b.mX - a.mX;
+        const float dy = b.mY - a.mY;
+        return std::sqrt(dx * dx + dy * dy);
+    }
+
+    /**
+     The ends of a stroke s are numbered 2s for its first point and 2s + 1 for its last point.
+     */
+    int getEntryEnd(int s) const
+    {
+        return 2 * s + (mReversed[s] ? 1 : 0);
+    }
+
+    int getExitEnd(int s) const
+    {
+        return 2 * s + (mReversed[s] ? 0 : 1);
+    }
+
+    bool isEntryEnd(int e) const
+    {
+        return getEntryEnd(e / 2) == e;
+    }
+
+    /**
+     The point where the stroke at position i is left, the start point for position -1.
+     */
+    PointMM getExit(int i) const
+    {
+        return i < 0 ? mStart : mEnds[getExitEnd(mTour[i])];
+    }
+
+    PointMM getEntry(int i) const
+    {
+        return mEnds[getEntryEnd(mTour[i])];
+    }
+
+    /**
+     Travel from p to the stroke at position i, or past the last one to the end point if there is one.
+     */
+    float getDistanceToEntry(PointMM p, int i) const
+    {
+        if (i < mNumStrokes)
+        {
+            return getDistance(p, getEntry(i));
+        }
+        return mHasEnd ? getDistance(p, mEnd) : 0.f;
+    }
+
+    float getLink(int i) const
+    {
+        return getDistanceToEntry(getExit(i - 1), i);
+    }
+
+    void computeNeighbours(const EndpointGrid& pGrid)
+    {
+        mNeighbours.resize(2 * mNumStrokes * cNumNeighbours, -1);
+        std::vector<int> lNearest;
+        for (int e = 0 ; e != 2 * mNumStrokes ; ++e)
+        {
+            // both ends of the stroke are among the nearest at worst
+            pGrid.findNearest(mEnds[e], cNumNeighbours + 2, lNearest);
+            int n = 0;
+            for (int lOther : lNearest)
+            {
+                if (lOther / 2 != e / 2 && n != cNumNeighbours)
+                {
+                    mNeighbours[e * cNumNeighbours + n++] = lOther;
+                }
+            }
+        }
+        pGrid.findNearest(mStart, cNumNeighbours, mStartNeighbours);
+        pGrid.findNearest(mEnd, cNumNeighbours, mEndNeighbours);
+    }
+
+    void seed(EndpointGrid& pGrid)
+    {
+        PointMM lCurrent = mStart;
+        std::vector<int> lNearest;
+        for (int i = 0 ; i != mNumStrokes ; ++i)
+        {
+            pGrid.findNearest(lCurrent, 1, lNearest);
+            const int s = lNearest.front() / 2;
+            pGrid.remove(2 * s, mEnds[2 * s]);
+            pGrid.remove(2 * s + 1, mEnds[2 * s + 1]);
+            mReversed[s] = (lNearest.front() % 2 == 1);
+            mTour[i] = s;
+            mPositions[s] = i;
+            lCurrent = mEnds[getExitEnd(s)];
+        }
+    }
+
+    /**
+     Gain of drawing the strokes at positions i to j backwards.
+     */
+    float getReversalGain(int i, int j) const
+    {
+        const float lAfter = getDistance(getExit(i - 1), getExit(j)) + getDistanceToEntry(getEntry(i), j + 1);
+        return getLink(i) + getLink(j + 1) - lAfter;
+    }
+
+    void reverse(int i, int j)
+    {
+        std::reverse(mTour.begin() + i, mTour.begin() + j + 1);
+        for (int k = i ; k <= j ; ++k)
+        {
+            mReversed[mTour[k]] = !mReversed[mTour[k]];
+            mPositions[mTour[k]] = k;
+        }
+    }
+
+    /**
+     Tries to link the ends of the stroke s to one of their neighbours by reversing a run of strokes: two exits are
+     linked by reversing the run after the first one up to the second one, two entries by reversing the run from the
+     first one up to the one before the second one.
+     */
+    bool tryTwoOpt(int s)
+    {
+        const int a = mPositions[s];
+        for (int lEnd : {getExitEnd(s), getEntryEnd(s)})
+        {
+            const bool cIsEntry = isEntryEnd(lEnd);
+            for (int n = 0 ; n != cNumNeighbours ; ++n)
+            {
+                const int lOther = mNeighbours[lEnd * cNumNeighbours + n];
+                if (lOther < 0 || isEntryEnd(lOther) != cIsEntry)
+                {
+                    continue;
+                }
+                const int b = mPositions[lOther / 2];
+                const int i = std::min(a, b) + (cIsEntry ? 0 : 1);
+                const int j = std::max(a, b) - (cIsEntry ? 1 : 0);
+                if (i <= j && getReversalGain(i, j) > cMinGainMM)
+                {
+                    reverse(i, j);
+                    return true;
+                }
+            }
+        }
+        // from the start point
+        if (a == 0)
+        {
+            for (int lOther : mStartNeighbours)
+            {
+                const int j = mPositions[lOther / 2];
+                if (!isEntryEnd(lOther) && getReversalGain(0, j) > cMinGainMM)
+                {
+                    reverse(0, j);
+                    return true;
+                }
+            }
+        }
+        // to the end point
+        if (a == mNumStrokes - 1 && mHasEnd)
+        {
+            for (int lOther : mEndNeighbours)
+            {
+                const int i = mPositions[lOther / 2];
+                if (isEntryEnd(lOther) && getReversalGain(i, mNumStrokes - 1) > cMinGainMM)
+                {
+                    reverse(i, mNumStrokes - 1);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    /**
+     Tries to move the runs of strokes starting or ending with the stroke s between the stroke whose exit is a
+     neighbour of the entry of the run and the next one, or backwards after the stroke whose exit is a neighbour of
+     the exit of the run.
+     */
+    bool tryOrOpt(int s)
+    {
+        const int a = mPositions[s];
+        for (int lLength = 1 ; lLength <= cMaxRunLength ; ++lLength)
+        {
+            for (int i : {a, a - lLength + 1})
+            {
+                const int j = i + lLength - 1;
+                if (i < 0 || j >= mNumStrokes || (lLength == 1 && i != a))
+                {
+                    continue;
+                }
+                const float lRemovalGain = getLink(i) + getLink(j + 1) - getDistanceToEntry(getExit(i - 1), j + 1);
+                if (lRemovalGain <= cMinGainMM)
+                {
+                    continue;
+                }
+                for (bool lBackwards : {false, true})
+                {
+                    const int lRunEntry = lBackwards ? getExitEnd(mTour[j]) : getEntryEnd(mTour[i]);
+                    const int lRunExit = lBackwards ? getEntryEnd(mTour[i]) : getExitEnd(mTour[j]);
+                    for (int n = 0 ; n != cNumNeighbours ; ++n)
+                    {
+                        // the run goes after p
+                        const int lOther = mNeighbours[lRunEntry * cNumNeighbours + n];
+                        if (lOther < 0 || isEntryEnd(lOther))
+                        {
+                            continue;
+                        }
+                        const int p = mPositions[lOther / 2];
+                        if (p >= i - 1 && p <= j)
+                        {
+                            continue;
+                        }
+                        const float lInsertionCost = getDistance(mEnds[lOther], mEnds[lRunEntry])
+                                + getDistanceToEntry(mEnds[lRunExit], p + 1) - getLink(p + 1);
+                        if (lRemovalGain - lInsertionCost > cMinGainMM)
+                        {
+                            move(i, j, p, lBackwards);
+                            return true;
+                        }
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    /**
+     Moves the strokes at positions i to j after the one at position p, reversing them if pBackwards.
+     */
+    void move(int i, int j, int p, bool pBackwards)
+    {
+        std::vector<int> lRun(mTour.begin() + i, mTour.begin() + j + 1);
+        if (pBackwards)
+        {
+            std::reverse(lRun.begin(), lRun.end());
+            for (int s : lRun)
+            {
+                mReversed[s] = !mReversed[s];
+            }
+        }
+        int lFirst;
+        int lLast;
+        if (p > j)
+        {
+            std::copy(mTour.begin() + j + 1, mTour.begin() + p + 1, mTour.begin() + i);
+            std::copy(lRun.begin(), lRun.end(), mTour.begin() + p - (j - i));
+            lFirst = i;
+            lLast = p;
+        }
+        else
+        {
+            std::copy_backward(mTour.begin() + p + 1, mTour.begin() + i, mTour.begin() + j + 1);
+            std::copy(lRun.begin(), lRun.end(), mTour.begin() + p + 1);
+            lFirst = p + 1;
+            lLast = j;
+        }
+        for (int k = lFirst ; k <= lLast ; ++k)
+        {
+            mPositions[mTour[k]] = k;
+        }
+    }
+
+    const PointMM mStart;
+    const PointMM mEnd;
+    const bool mHasEnd;
+    const int mNumStrokes;
+    std::vector<PointMM> mEnds;
+    std::vector<int> mNeighbours;
+    std::vector<int> mStartNeighbours;
+    std::vector<int> mEndNeighbours;
+    std::vector<int> mTour;
+    std::vector<int> mPositions;
+    std::vector<bool> mReversed;
+};
+
+}
+
+#endif
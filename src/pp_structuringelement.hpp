@@ -0,0 +1,334 @@
+#ifndef PP_STRUCTURINGELEMENT_HPP_INCLUDED
+#define PP_STRUCTURINGELEMENT_HPP_INCLUDED
+
+/**
+ @file      pp_structuringelement.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include "pp_packedbinaryimage.hpp"
+
+#include <vector>
+
+namespace PP
+{
+
+namespace MorphOps
+{
+    enum StructuringElement
+    {
+        eSquareElement,     ///< |dx| <= r and |dy| <= r
+        eDiamondElement,    ///< |dx| + |dy| <= r
+        eOctagonElement     ///< square of radius (r + 1) / 2 dilated by a diamond of radius r / 2
+    };
+
+    /**
+     In-place transposition of a 64x64 bit block, bit x of word y becoming bit y of word x.
+     */
+    static void transposeBlock(PackedBinaryImage::Word pBlock[64])
+    {
+        // Hacker's Delight, 7-3
+        typedef PackedBinaryImage::Word Word;
+        Word lMask = 0x00000000FFFFFFFFull;
+        for (int j = 32 ; j != 0 ; j >>= 1, lMask ^= (lMask << j))
+        {
+            for (int k = 0 ; k < 64 ; k = ((k | j) + 1) & ~j)
+            {
+                Word t = ((pBlock[k] >> j) ^ pBlock[k | j]) & lMask;
+                pBlock[k] ^= t << j;
+                pBlock[k | j] ^= t;
+            }
+        }
+    }
+
+    static PackedBinaryImage transposed(const PackedBinaryImage& pImage)
+    {
+        typedef PackedBinaryImage::Word Word;
+        const size_t cWidth = pImage.getWidth();
+        const size_t cHeight = pImage.getHeight();
+        PackedBinaryImage lTransposed(cHeight, cWidth);
+        // a strip of 64 rows becomes a column of words, the strips being transposed in parallel
+        const size_t cNumStrips = (cHeight + 63) / 64;
+        forEachRowBand(cNumStrips, 64 * pImage.getWordsPerRow(), [&](size_t pFirst, size_t pLast) {
+            Word lBlock[64];
+            for (size_t y0 = 64 * pFirst ; y0 < 64 * pLast ; y0 += 64)
+            {
+                for (size_t k = 0 ; k != pImage.getWordsPerRow() ; ++k)
+                {
+                    for (size_t y = 0 ; y != 64 ; ++y)
+                    {
+                        lBlock[y] = (y0 + y < cHeight) ? pImage.getRow(y0 + y)[k] : 0;
+                    }
+                    transposeBlock(lBlock);
+                    for (size_t x = 0 ; x != 64 && 64 * k + x < cWidth ; ++x)
+                    {
+                        lTransposed.getRow(64 * k + x)[y0 / 64] = lBlock[x];
+                    }
+                }
+            }
+        });
+        return lTransposed;
+    }
+
+    /**
+     Row whose bit x is bit x + pOffset of pSrc, bits outside of the row being cleared.
+     Returns pSrc itself when there is nothing to shift, pBuffer otherwise.
+     */
+    static const PackedBinaryImage::Word* shiftRow(const PackedBinaryImage::Word* pSrc, PackedBinaryImage::Word* pBuffer, size_t pNumWords, int pOffset, PackedBinaryImage::Word pLastWordMask)
+    {
+        typedef PackedBinaryImage::Word Word;
+        if (pOffset == 0)
+        {
+            return pSrc;
+        }
+        const int cNumWords = (int)pNumWords;
+        const int cWordOffset = (pOffset >= 0) ? pOffset / 64 : -((-pOffset + 63) / 64);
+        const int cBitOffset = pOffset - 64 * cWordOffset;
+        for (int k = 0 ; k < cNumWords ; ++k)
+        {
+            const int lLow = k + cWordOffset;
+            Word lWord = (lLow >= 0 && lLow < cNumWords) ? (pSrc[lLow] >> cBitOffset) : 0;
+            if (cBitOffset != 0 && lLow + 1 >= 0 && lLow + 1 < cNumWords)
+            {
+                lWord |= pSrc[lLow + 1] << (64 - cBitOffset);
+            }
+            pBuffer[k] = lWord;
+        }
+        if (cNumWords > 0)
+        {
+            pBuffer[cNumWords - 1] &= pLastWordMask;
+        }
+        return pBuffer;
+    }
+
+    /**
+     Erosion (AND) or dilation (OR) along the lines of direction (pShift, 1), over the 2 * pRadius + 1 pixels centred on
+     every pixel, the outside of the image being background.
+     van Herk / Gil-Werman: the rows are split in blocks of the window length, in which running prefixes and suffixes
+     are accumulated, so that every window is the combination of one suffix and one prefix whatever the radius.
+     */
+    static PackedBinaryImage lineFilter(const PackedBinaryImage& pSrc, int pRadius, int pShift, bool pDilate)
+    {
+        typedef PackedBinaryImage::Word Word;
+        const int cHeight = (int)pSrc.getHeight();
+        const size_t cNumWords = pSrc.getWordsPerRow();
+        const Word cLastWordMask = pSrc.getLastWordMask();
+        const int cLength = 2 * pRadius + 1;
+        const int cPaddedHeight = cHeight + 2 * pRadius;
+        auto lCombine = [pDilate](Word a, Word b) {
+            return pDilate ? (a | b) : (a & b);
+        };
+
+        // padded row i is row i - pRadius
+        std::vector<Word> lPrefixes(cPaddedHeight * cNumWords, 0);
+        std::vector<Word> lSuffixes(cPaddedHeight * cNumWords, 0);
+        auto lRow = [&](int i) {
+            const int y = i - pRadius;
+            return (y >= 0 && y < cHeight) ? pSrc.getRow(y) : nullptr;
+        };
+        auto lCopyRow = [&](int i, Word* pDst) {
+            const Word* lSrc = lRow(i);
+            for (size_t k = 0 ; k != cNumWords ; ++k)
+            {
+                pDst[k] = lSrc ? lSrc[k] : 0;
+            }
+        };
+
+        // the blocks are independent, and processed by bands in parallel
+        const size_t cNumBlocks = (cPaddedHeight + cLength - 1) / cLength;
+        forEachRowBand(cNumBlocks, cLength * cNumWords, [&](size_t pFirst, size_t pLast) {
+            std::vector<Word> lShifted(cNumWords);
+            for (int lBlockStart = (int)pFirst * cLength ; lBlockStart < std::min((int)pLast * cLength, cPaddedHeight) ; lBlockStart += cLength)
+            {
+                const int lBlockEnd = std::min(lBlockStart + cLength, cPaddedHeight);
+                lCopyRow(lBlockStart, &lPrefixes[lBlockStart * cNumWords]);
+                for (int i = lBlockStart + 1 ; i < lBlockEnd ; ++i)
+                {
+                    // g[i](x) = row[i](x) op g[i-1](x - shift)
+                    const Word* lPrevious = shiftRow(&lPrefixes[(i - 1) * cNumWords], lShifted.data(), cNumWords, -pShift, cLastWordMask);
+                    const Word* lSrc = lRow(i);
+                    for (size_t k = 0 ; k != cNumWords ; ++k)
+                    {
+                        lPrefixes[i * cNumWords + k] = lCombine(lSrc ? lSrc[k] : 0, lPrevious[k]);
+                    }
+                }
+                lCopyRow(lBlockEnd - 1, &lSuffixes[(lBlockEnd - 1) * cNumWords]);
+                for (int i = lBlockEnd - 2 ; i >= lBlockStart ; --i)
+                {
+                    // h[i](x) = row[i](x) op h[i+1](x + shift)
+                    const Word* lNext = shiftRow(&lSuffixes[(i + 1) * cNumWords], lShifted.data(), cNumWords, pShift, cLastWordMask);
+                    const Word* lSrc = lRow(i);
+                    for (size_t k = 0 ; k != cNumWords ; ++k)
+                    {
+                        lSuffixes[i * cNumWords + k] = lCombine(lSrc ? lSrc[k] : 0, lNext[k]);
+                    }
+                }
+            }
+        });
+
+        // window of row y: h[y - r](x - r * shift) op g[y + r](x + r * shift), in padded rows y and y + 2r
+        PackedBinaryImage lDst(pSrc.getWidth(), pSrc.getHeight());
+        forEachRowBand(cHeight, cNumWords, [&](size_t pFirst, size_t pLast) {
+            std::vector<Word> lShiftedSuffix(cNumWords);
+            std::vector<Word> lShiftedPrefix(cNumWords);
+            for (int y = (int)pFirst ; y < (int)pLast ; ++y)
+            {
+                const Word* lSuffix = shiftRow(&lSuffixes[y * cNumWords], lShiftedSuffix.data(), cNumWords, -pRadius * pShift, cLastWordMask);
+                const Word* lPrefix = shiftRow(&lPrefixes[(y + 2 * pRadius) * cNumWords], lShiftedPrefix.data(), cNumWords, pRadius * pShift, cLastWordMask);
+                Word* lDstRow = lDst.getRow(y);
+                for (size_t k = 0 ; k != cNumWords ; ++k)
+                {
+                    lDstRow[k] = lCombine(lSuffix[k], lPrefix[k]);
+                }
+            }
+        });
+        return lDst;
+    }
+
+    /**
+     Erosion or dilation by the 3x3 square.
+     */
+    static void boxFilter(PackedBinaryImage& pImage, bool pDilate)
+    {
+        typedef PackedBinaryImage::Word Word;
+        PackedBinaryImage lFiltered(pImage.getWidth(), pImage.getHeight());
+        forEachPackedNeighbourhood(pImage, lFiltered, [pDilate](Word c, const PackedNeighbourhood& n, size_t, size_t) {
+            return pDilate ? (c | n.any()) : (c & n.all());
+        });
+        pImage.swap(lFiltered);
+    }
+
+    /**
+     Erosion or dilation by the cross made of a pixel and its 4-neighbours.
+     */
+    static void crossFilter(PackedBinaryImage& pImage, bool pDilate)
+    {
+        typedef PackedBinaryImage::Word Word;
+        PackedBinaryImage lFiltered(pImage.getWidth(), pImage.getHeight());
+        forEachPackedNeighbourhood(pImage, lFiltered, [pDilate](Word c, const PackedNeighbourhood& n, size_t, size_t) {
+            return pDilate ? (c | n.p2 | n.p4 | n.p6 | n.p8) : (c & n.p2 & n.p4 & n.p6 & n.p8);
+        });
+        pImage.swap(lFiltered);
+    }
+
+    /**
+     Erosion or dilation by a structuring element decomposed into lines and crosses, the filter by a Minkowski sum of
+     elements being the successive filters by each of them:
+     the square is the sum of an horizontal and a vertical line, the diamond of an odd radius 2k + 1 is the sum of a cross
+     and of two diagonal lines of radius k, one of an even radius is the sum of a cross and of the diamond of radius - 1.
+     */
+    static void structuringElementFilter(PackedBinaryImage& pImage, StructuringElement pElement, int pRadius, bool pDilate)
+    {
+        if (pRadius <= 0)
+        {
+            return;
+        }
+        switch (pElement)
+        {
+            case eSquareElement:
+            {
+                // for small radii, the repeated 3x3 filter is cheaper than the two transpositions
+                const int cMaxRepeatedRadius = 4;
+                if (pRadius <= cMaxRepeatedRadius)
+                {
+                    for (int u = 0 ; u < pRadius ; ++u)
+                    {
+                        boxFilter(pImage, pDilate);
+                    }
+                    break;
+                }
+                PackedBinaryImage lVertical = lineFilter(pImage, pRadius, 0, pDilate);
+                PackedBinaryImage lFiltered = transposed(lineFilter(transposed(lVertical), pRadius, 0, pDilate));
+                pImage.swap(lFiltered);
+                break;
+            }
+            case eDiamondElement:
+            {
+                if (pRadius % 2 == 0)
+                {
+                    crossFilter(pImage, pDilate);
+                }
+                crossFilter(pImage, pDilate);
+                const int lDiagonalRadius = (pRadius - 1) / 2;
+                if (lDiagonalRadius > 0)
+                {
+                    PackedBinaryImage lDiagonal = lineFilter(pImage, lDiagonalRadius, 1, pDilate);
+                    PackedBinaryImage lFiltered = lineFilter(lDiagonal, lDiagonalRadius, -1, pDilate);
+                    pImage.swap(lFiltered);
+                }
+                break;
+            }
+            case eOctagonElement:
+            {
+                structuringElementFilter(pImage, eSquareElement, (pRadius + 1) / 2, pDilate);
+                structuringElementFilter(pImage, eDiamondElement, pRadius / 2, pDilate);
+                break;
+            }
+        }
+    }
+
+    /**
+     Erosion by a structuring element of any radius in a constant time per pixel, the outside of the image being
+     background. Eroding by the square of radius r is the same as r calls to erode(PackedBinaryImage&).
+     */
+    static void erode(PackedBinaryImage& pImage, StructuringElement pElement, int pRadius)
+    {
+        structuringElementFilter(pImage, pElement, pRadius, false);
+    }
+
+    /**
+     Dilation by a structuring element of any radius in a constant time per pixel, the outside of the image being
+     background.
+     */
+    static void dilate(PackedBinaryImage& pImage, StructuringElement pElement, int pRadius)
+    {
+        typedef PackedBinaryImage::Word Word;
+        if (pRadius <= 0)
+        {
+            return;
+        }
+
+        // the intermediate results of the decomposition may go out of the image and come back in,
+        // so it is dilated with a margin of whole words
+        const size_t cMarginWords = (pRadius + 63) / 64;
+        const size_t cMarginRows = pRadius;
+        const size_t cNumWords = pImage.getWordsPerRow();
+        PackedBinaryImage lPadded(pImage.getWidth() + 128 * cMarginWords, pImage.getHeight() + 2 * cMarginRows);
+        for (size_t y = 0 ; y != pImage.getHeight() ; ++y)
+        {
+            std::copy(pImage.getRow(y), pImage.getRow(y) + cNumWords, lPadded.getRow(y + cMarginRows) + cMarginWords);
+        }
+
+        structuringElementFilter(lPadded, pElement, pRadius, true);
+
+        const Word cLastWordMask = pImage.getLastWordMask();
+        for (size_t y = 0 ; y != pImage.getHeight() ; ++y)
+        {
+            Word* lRow = pImage.getRow(y);
+            std::copy(lPadded.getRow(y + cMarginRows) + cMarginWords, lPadded.getRow(y + cMarginRows) + cMarginWords + cNumWords, lRow);
+            if (cNumWords > 0)
+            {
+                lRow[cNumWords - 1] &= cLastWordMask;
+            }
+        }
+    }
+
+    inline void erode(BinaryImage& pImage, StructuringElement pElement, int pRadius)
+    {
+        PackedBinaryImage lPacked(pImage);
+        erode(lPacked, pElement, pRadius);
+        pImage = lPacked.toBinaryImage();
+    }
+
+    inline void dilate(BinaryImage& pImage, StructuringElement pElement, int pRadius)
+    {
+        PackedBinaryImage lPacked(pImage);
+        dilate(lPacked, pElement, pRadius);
+        pImage = lPacked.toBinaryImage();
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,293 @@
+#ifndef PP_THINNING_HPP_INCLUDED
+#define PP_THINNING_HPP_INCLUDED
+
+/**
+ @file      pp_thinning.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include "pp_utils.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define PP_THINNING_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define PP_THINNING_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+namespace PP
+{
+
+/**
+ Zhang-Suen thinning driven by lookup tables.
+
+ The 8-neighbourhood of a pixel is packed into a byte, bit 0 being p2 and bit 7 being p9 with the labels of
+ MorphOps::thinReference, and each subiteration looks up whether the pixel is removed in a table computed at compile
+ time from the conditions A to D. The SIMD kernels evaluate the same conditions on 16 or 32 pixels at once.
+ */
+namespace Thinning
+{
+    enum Kernel
+    {
+        eScalarKernel,
+        eSSE2Kernel,
+        eAVX2Kernel
+    };
+
+    constexpr int neighbour(int pCode, int pIndex)
+    {
+        return (pCode >> (pIndex % 8)) & 1;
+    }
+
+    constexpr int countNeighbours(int pCode)
+    {
+        return pCode == 0 ? 0 : (pCode & 1) + countNeighbours(pCode >> 1);
+    }
+
+    constexpr int countTransitions(int pCode, int pIndex = 0)
+    {
+        return pIndex == 8 ? 0
+             : ((!neighbour(pCode, pIndex) && neighbour(pCode, pIndex + 1)) ? 1 : 0) + countTransitions(pCode, pIndex + 1);
+    }
+
+    /**
+     Whether a set pixel with this neighbourhood is removed by the given subiteration (0 or 1).
+     p2, p4, p6 and p8 are the bits 0, 2, 4 and 6.
+     */
+    constexpr bool isRemovable(int pCode, int pSubiteration)
+    {
+        return countNeighbours(pCode) >= 2 && countNeighbours(pCode) <= 6
+            && countTransitions(pCode) == 1
+            && (pSubiteration == 0
+                ? (!(neighbour(pCode, 0) && neighbour(pCode, 2) && neighbour(pCode, 4))
+                   && !(neighbour(pCode, 2) && neighbour(pCode, 4) && neighbour(pCode, 6)))
+                : (!(neighbour(pCode, 0) && neighbour(pCode, 2) && neighbour(pCode, 6))
+                   && !(neighbour(pCode, 0) && neighbour(pCode, 4) && neighbour(pCode, 6))));
+    }
+
+    template <int... I> struct IndexList {};
+    template <int N, int... I> struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> {};
+    template <int... I> struct MakeIndexList<0, I...> { typedef IndexList<I...> Type; };
+
+    template <int Subiteration, typename List> struct Table;
+    template <int Subiteration, int... I>
+    struct Table<Subiteration, IndexList<I...>>
+    {
+        static constexpr uint8_t cRemovable[sizeof...(I)] = { isRemovable(I, Subiteration)... };
+    };
+    template <int Subiteration, int... I>
+    constexpr uint8_t Table<Subiteration, IndexList<I...>>::cRemovable[sizeof...(I)];
+
+    typedef Table<0, MakeIndexList<256>::Type> FirstTable;
+    typedef Table<1, MakeIndexList<256>::Type> SecondTable;
+
+    static_assert(!FirstTable::cRemovable[0xFF] && !SecondTable::cRemovable[0x00], "interior and isolated pixels are kept");
+
+    inline const uint8_t* getTable(int pSubiteration)
+    {
+        return pSubiteration == 0 ? FirstTable::cRemovable : SecondTable::cRemovable;
+    }
+
+    /**
+     Neighbourhood code of the pixel at pIndex in a padded image of 0/1 bytes.
+     */
+    inline int getCode(const uint8_t* pPixels, ptrdiff_t pIndex, ptrdiff_t pStride)
+    {
+        return  pPixels[pIndex - 1]
+             | (pPixels[pIndex - 1 + pStride] << 1)
+             | (pPixels[pIndex     + pStride] << 2)
+             | (pPixels[pIndex + 1 + pStride] << 3)
+             | (pPixels[pIndex + 1          ] << 4)
+             | (pPixels[pIndex + 1 - pStride] << 5)
+             | (pPixels[pIndex     - pStride] << 6)
+             | (pPixels[pIndex - 1 - pStride] << 7);
+    }
+
+    /**
+     Scalar subiteration on the pixels [pFromX, pToX) of the row starting at pRow.
+     */
+    inline void subiterateScalar(const uint8_t* pSrc, uint8_t* pDst, ptrdiff_t pRow, ptrdiff_t pStride, int pFromX, int pToX, const uint8_t* pTable)
+    {
+        for (int x = pFromX ; x < pToX ; ++x)
+        {
+            const ptrdiff_t i = pRow + x;
+            pDst[i] = pSrc[i] && ! pTable[getCode(pSrc, i, pStride)];
+        }
+    }
+
+#if PP_THINNING_SSE2
+    /**
+     Conditions A to D on 16 pixels, the neighbours being 0/1 bytes.
+     */
+    inline __m128i removedSSE2(__m128i c, __m128i p2, __m128i p3, __m128i p4, __m128i p5, __m128i p6, __m128i p7, __m128i p8, __m128i p9, int pSubiteration)
+    {
+        const __m128i lZero = _mm_setzero_si128();
+        const __m128i lOne = _mm_set1_epi8(1);
+        __m128i lSum = _mm_add_epi8(_mm_add_epi8(_mm_add_epi8(p2, p3), _mm_add_epi8(p4, p5)),
+                                    _mm_add_epi8(_mm_add_epi8(p6, p7), _mm_add_epi8(p8, p9)));
+        __m128i lA = _mm_and_si128(_mm_cmpgt_epi8(lSum, lOne), _mm_cmplt_epi8(lSum, _mm_set1_epi8(7)));
+        __m128i lTransitions = _mm_add_epi8(_mm_add_epi8(_mm_add_epi8(_mm_andnot_si128(p2, p3), _mm_andnot_si128(p3, p4)),
+                                                         _mm_add_epi8(_mm_andnot_si128(p4, p5), _mm_andnot_si128(p5, p6))),
+                                            _mm_add_epi8(_mm_add_epi8(_mm_andnot_si128(p6, p7), _mm_andnot_si128(p7, p8)),
+                                                         _mm_add_epi8(_mm_andnot_si128(p8, p9), _mm_andnot_si128(p9, p2))));
+        __m128i lB = _mm_cmpeq_epi8(lTransitions, lOne);
+        __m128i lC = (pSubiteration == 0) ? _mm_and_si128(p2, _mm_and_si128(p4, p6)) : _mm_and_si128(p2, _mm_and_si128(p4, p8));
+        __m128i lD = (pSubiteration == 0) ? _mm_and_si128(p4, _mm_and_si128(p6, p8)) : _mm_and_si128(p2, _mm_and_si128(p6, p8));
+        __m128i lCD = _mm_cmpeq_epi8(_mm_or_si128(lC, lD), lZero);
+        return _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(c, lOne), lA), _mm_and_si128(lB, lCD));
+    }
+
+    inline void subiterateSSE2(const uint8_t* pSrc, uint8_t* pDst, ptrdiff_t pRow, ptrdiff_t pStride, int pWidth, int pSubiteration)
+    {
+        int x = 1;
+        for ( ; x + 16 <= pWidth + 1 ; x += 16)
+        {
+            const uint8_t* lCentre = pSrc + pRow + x;
+            __m128i c  = _mm_loadu_si128((const __m128i*)(lCentre));
+            __m128i p2 = _mm_loadu_si128((const __m128i*)(lCentre - 1));
+            __m128i p3 = _mm_loadu_si128((const __m128i*)(lCentre - 1 + pStride));
+            __m128i p4 = _mm_loadu_si128((const __m128i*)(lCentre     + pStride));
+            __m128i p5 = _mm_loadu_si128((const __m128i*)(lCentre + 1 + pStride));
+            __m128i p6 = _mm_loadu_si128((const __m128i*)(lCentre + 1));
+            __m128i p7 = _mm_loadu_si128((const __m128i*)(lCentre + 1 - pStride));
+            __m128i p8 = _mm_loadu_si128((const __m128i*)(lCentre     - pStride));
+            __m128i p9 = _mm_loadu_si128((const __m128i*)(lCentre - 1 - pStride));
+            __m128i lRemoved = removedSSE2(c, p2, p3, p4, p5, p6, p7, p8, p9, pSubiteration);
+            _mm_storeu_si128((__m128i*)(pDst + pRow + x), _mm_andnot_si128(lRemoved, c));
+        }
+        subiterateScalar(pSrc, pDst, pRow, pStride, x, pWidth + 1, getTable(pSubiteration));
+    }
+#endif
+
+#if PP_THINNING_AVX2
+    __attribute__((target("avx2")))
+    inline void subiterateAVX2(const uint8_t* pSrc, uint8_t* pDst, ptrdiff_t pRow, ptrdiff_t pStride, int pWidth, int pSubiteration)
+    {
+        const __m256i lZero = _mm256_setzero_si256();
+        const __m256i lOne = _mm256_set1_epi8(1);
+        const __m256i lSeven = _mm256_set1_epi8(7);
+        int x = 1;
+        for ( ; x + 32 <= pWidth + 1 ; x += 32)
+        {
+            const uint8_t* lCentre = pSrc + pRow + x;
+            __m256i c  = _mm256_loadu_si256((const __m256i*)(lCentre));
+            __m256i p2 = _mm256_loadu_si256((const __m256i*)(lCentre - 1));
+            __m256i p3 = _mm256_loadu_si256((const __m256i*)(lCentre - 1 + pStride));
+            __m256i p4 = _mm256_loadu_si256((const __m256i*)(lCentre     + pStride));
+            __m256i p5 = _mm256_loadu_si256((const __m256i*)(lCentre + 1 + pStride));
+            __m256i p6 = _mm256_loadu_si256((const __m256i*)(lCentre + 1));
+            __m256i p7 = _mm256_loadu_si256((const __m256i*)(lCentre + 1 - pStride));
+            __m256i p8 = _mm256_loadu_si256((const __m256i*)(lCentre     - pStride));
+            __m256i p9 = _mm256_loadu_si256((const __m256i*)(lCentre - 1 - pStride));
+            __m256i lSum = _mm256_add_epi8(_mm256_add_epi8(_mm256_add_epi8(p2, p3), _mm256_add_epi8(p4, p5)),
+                                           _mm256_add_epi8(_mm256_add_epi8(p6, p7), _mm256_add_epi8(p8, p9)));
+            __m256i lA = _mm256_and_si256(_mm256_cmpgt_epi8(lSum, lOne), _mm256_cmpgt_epi8(lSeven, lSum));
+            __m256i lTransitions = _mm256_add_epi8(_mm256_add_epi8(_mm256_add_epi8(_mm256_andnot_si256(p2, p3), _mm256_andnot_si256(p3, p4)),
+                                                                   _mm256_add_epi8(_mm256_andnot_si256(p4, p5), _mm256_andnot_si256(p5, p6))),
+                                                   _mm256_add_epi8(_mm256_add_epi8(_mm256_andnot_si256(p6, p7), _mm256_andnot_si256(p7, p8)),
+                                                                   _mm256_add_epi8(_mm256_andnot_si256(p8, p9), _mm256_andnot_si256(p9, p2))));
+            __m256i lB = _mm256_cmpeq_epi8(lTransitions, lOne);
+            __m256i lC = (pSubiteration == 0) ? _mm256_and_si256(p2, _mm256_and_si256(p4, p6)) : _mm256_and_si256(p2, _mm256_and_si256(p4, p8));
+            __m256i lD = (pSubiteration == 0) ? _mm256_and_si256(p4, _mm256_and_si256(p6, p8)) : _mm256_and_si256(p2, _mm256_and_si256(p6, p8));
+            __m256i lCD = _mm256_cmpeq_epi8(_mm256_or_si256(lC, lD), lZero);
+            __m256i lRemoved = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(c, lOne), lA), _mm256_and_si256(lB, lCD));
+            _mm256_storeu_si256((__m256i*)(pDst + pRow + x), _mm256_andnot_si256(lRemoved, c));
+        }
+        subiterateScalar(pSrc, pDst, pRow, pStride, x, pWidth + 1, getTable(pSubiteration));
+    }
+#endif
+
+    /**
+     Most efficient kernel supported by the running CPU.
+     */
+    inline Kernel getBestKernel()
+    {
+#if PP_THINNING_AVX2
+        static const Kernel sKernel = __builtin_cpu_supports("avx2") ? eAVX2Kernel : eSSE2Kernel;
+        return sKernel;
+#elif PP_THINNING_SSE2
+        return eSSE2Kernel;
+#else
+        return eScalarKernel;
+#endif
+    }
+
+    /**
+     One subiteration over the padded images pSrc and pDst of 0/1 bytes, whose borders stay cleared.
+     */
+    inline void subiterate(const uint8_t* pSrc, uint8_t* pDst, int pWidth, int pHeight, int pSubiteration, Kernel pKernel)
+    {
+        const ptrdiff_t cStride = pWidth + 2;
+        const uint8_t* lTable = getTable(pSubiteration);
+        for (int y = 1 ; y <= pHeight ; ++y)
+        {
+            const ptrdiff_t lRow = y * cStride;
+            switch (pKernel)
+            {
+#if PP_THINNING_AVX2
+                case eAVX2Kernel:
+                    subiterateAVX2(pSrc, pDst, lRow, cStride, pWidth, pSubiteration);
+                    break;
+#endif
+#if PP_THINNING_SSE2
+                case eSSE2Kernel:
+                    subiterateSSE2(pSrc, pDst, lRow, cStride, pWidth, pSubiteration);
+                    break;
+#endif
+                default:
+                    subiterateScalar(pSrc, pDst, lRow, cStride, 1, pWidth + 1, lTable);
+                    break;
+            }
+        }
+    }
+
+    /**
+     One Zhang-Suen iteration (both subiterations), identical to MorphOps::thinReference.
+     */
+    inline void thin(BinaryImage& pImage, Kernel pKernel = getBestKernel())
+    {
+        const int cWidth = (int)pImage.getWidth();
+        const int cHeight = (int)pImage.getHeight();
+        const size_t cStride = cWidth + 2;
+
+        // add a border
+        std::vector<uint8_t> lOriginal(cStride * (cHeight + 2), 0);
+        for (int y = 0 ; y != cHeight ; ++y)
+        {
+            for (int x = 0 ; x != cWidth ; ++x)
+            {
+                lOriginal[(y + 1) * cStride + x + 1] = pImage.getPixel(x, y) ? 1 : 0;
+            }
+        }
+        std::vector<uint8_t> lThinned(lOriginal.size(), 0);
+
+        subiterate(lOriginal.data(), lThinned.data(), cWidth, cHeight, 0, pKernel);
+        subiterate(lThinned.data(), lOriginal.data(), cWidth, cHeight, 1, pKernel);
+
+        for (int y = 0 ; y != cHeight ; ++y)
+        {
+            for (int x = 0 ; x != cWidth ; ++x)
+            {
+                pImage.getPixel(x, y) = lOriginal[(y + 1) * cStride + x + 1] != 0;
+            }
+        }
+    }
+}
+
+namespace MorphOps
+{
+    inline void thin(BinaryImage& pImage)
+    {
+        Thinning::thin(pImage);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef PP_THREADPOOL_HPP_INCLUDED
+#define PP_THREADPOOL_HPP_INCLUDED
+
+/**
+ @file      pp_threadpool.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PP
+{
+
+/**
+ Fixed set of worker threads executing the iterations of parallelFor().
+ A thread waiting for its parallelFor() executes pending tasks meanwhile, so that parallel loops can be nested.
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int pNumThreads = 1)
+    {
+        start(pNumThreads);
+    }
+
+    ~ThreadPool()
+    {
+        stop();
+    }
+
+    /**
+     The pool shared by the whole application, sized by setNumThreads().
+     */
+    static ThreadPool& getInstance()
+    {
+        static ThreadPool sInstance(getDefaultNumThreads());
+        return sInstance;
+    }
+
+    static int getDefaultNumThreads()
+    {
+        return std::max(1, (int)std::thread::hardware_concurrency());
+    }
+
+    /**
+     Number of threads running the tasks, including the calling one. Must not be called while tasks are running.
+     */
+    void setNumThreads(int pNumThreads)
+    {
+        stop();
+        start(pNumThreads);
+    }
+
+    int getNumThreads() const
+    {
+        return (int)mWorkers.size() + 1;
+    }
+
+    /**
+     Calls pFunction(i) for every i in [pBegin, pEnd) and returns when all calls are done.
+     One task per thread is queued, every task and the calling thread claiming the next index until there is none
+     left, so that the threads finishing early take over the remaining iterations.
+     The first exception thrown by a call is rethrown.
+     */
+    template <typename Function>
+    void parallelFor(int pBegin, int pEnd, Function pFunction)
+    {
+        if (pEnd - pBegin <= 0)
+        {
+            return;
+        }
+        if (mWorkers.empty() || pEnd - pBegin == 1)
+        {
+            for (int i = pBegin ; i != pEnd ; ++i)
+            {
+                pFunction(i);
+            }
+            return;
+        }
+
+        std::atomic<int> lNext(pBegin);
+        std::exception_ptr lException;
+        auto lRun = [&]() {
+            for (int i = lNext++ ; i < pEnd ; i = lNext++)
+            {
+                try
+                {
+                    pFunction(i);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lExceptionLock(mExceptionMutex);
+                    if (!lException)
+                    {
+                        lException = std::current_exception();
+                    }
+                }
+            }
+        };
+
+        // the calling thread being one of them
+        const int cNumTasks = std::min(pEnd - pBegin, getNumThreads()) - 1;
+        std::atomic<int> lRemaining(cNumTasks);
+        {
+            std::lock_guard<std::mutex> lLock(mMutex);
+            for (int t = 0 ; t != cNumTasks ; ++t)
+            {
+                mTasks.push_back([&]() {
+                    lRun();
+                    if (--lRemaining == 0)
+                    {
+                        std::lock_guard<std::mutex> lLock(mMutex);
+                        mCondition.notify_all();
+                    }
+                });
+            }
+        }
+        mCondition.notify_all();
+
+        lRun();
+
+        // help while waiting
+        std::unique_lock<std::mutex> lLock(mMutex);
+        while (lRemaining != 0)
+        {
+            if (!mTasks.empty())
+            {
+                std::function<void()> lTask = std::move(mTasks.front());
+                mTasks.pop_front();
+                lLock.unlock();
+                lTask();
+                lLock.lock();
+            }
+            else
+            {
+                mCondition.wait(lLock);
+            }
+        }
+        lLock.unlock();
+
+        if (lException)
+        {
+            std::rethrow_exception(lException);
+        }
+    }
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator =(const ThreadPool&) = delete;
+
+    void start(int pNumThreads)
+    {
+        mStopping = false;
+        for (int i = 1 ; i < pNumThreads ; ++i)
+        {
+            mWorkers.push_back(std::thread([this]() {
+                work();
+            }));
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lLock(mMutex);
+            mStopping = true;
+        }
+        mCondition.notify_all();
+        for (std::thread& lWorker : mWorkers)
+        {
+            lWorker.join();
+        }
+        mWorkers.clear();
+    }
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lLock(mMutex);
+        while (true)
+        {
+            if (!mTasks.empty())
+            {
+                std::function<void()> lTask = std::move(mTasks.front());
+                mTasks.pop_front();
+                lLock.unlock();
+                lTask();
+                lLock.lock();
+            }
+            else if (mStopping)
+            {
+                return;
+            }
+            else
+            {
+                mCondition.wait(lLock);
+            }
+        }
+    }
+
+    std::vector<std::thread> mWorkers;
+    std::deque<std::function<void()>> mTasks;
+    std::mutex mMutex;
+    std::mutex mExceptionMutex;
+    std::condition_variable mCondition;
+    bool mStopping = false;
+};
+
+}
+
+#endif
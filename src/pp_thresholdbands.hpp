@@ -0,0 +1,176 @@
+#ifndef PP_THRESHOLDBANDS_HPP_INCLUDED
+#define PP_THRESHOLDBANDS_HPP_INCLUDED
+
+/**
+ @file      pp_thresholdbands.hpp
+ @copyright François Becker
+ @date      2017-2018
+ */
+
+#include "pp_lightnessimage.hpp"
+#include "pp_packedbinaryimage.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define PP_THRESHOLDBANDS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace PP
+{
+
+/**
+ Lightness of an image quantized by all the thresholds of a project at once.
+ The band of a pixel is the number of thresholds its lightness is greater than or equal to, so that the mask of the
+ pixels darker than the k-th threshold in increasing order is the set of the pixels of band k or lower.
+ */
+class ThresholdBands
+{
+public:
+    typedef uint8_t Band;
+
+    /**
+     Most thresholds of different cutoffs, whose bands all fit in a Band.
+     */
+    static const size_t cMaxCutoffs = 255;
+
+    ThresholdBands()
+    : mWidth(0)
+    , mHeight(0)
+    , mSourceKey(0)
+    {
+    }
+
+    ThresholdBands(const LightnessImage& pLightness, const std::vector<float>& pThresholds)
+    : mWidth(pLightness.getWidth())
+    , mHeight(pLightness.getHeight())
+    , mSourceKey(pLightness.getSourceKey())
+    , mCutoffs(getCutoffs(pThresholds))
+    , mData(mWidth * mHeight)
+    {
+        assert(mCutoffs.size() <= cMaxCutoffs);
+
+        // band of every lightness value, then one lookup per pixel
+        std::vector<Band> lBandOfValue(65536);
+        size_t lBand = 0;
+        for (uint32_t v = 0 ; v != 65536 ; ++v)
+        {
+            while (lBand != mCutoffs.size() && v >= mCutoffs[lBand])
+            {
+                ++lBand;
+            }
+            lBandOfValue[v] = (Band)lBand;
+        }
+        for (size_t y = 0 ; y != mHeight ; ++y)
+        {
+            const LightnessImage::Value* lSrc = pLightness.getRow(y);
+            Band* lDst = &mData[y * mWidth];
+            for (size_t x = 0 ; x != mWidth ; ++x)
+            {
+                lDst[x] = lBandOfValue[lSrc[x]];
+            }
+        }
+    }
+
+    /**
+     Cutoffs of pThresholds in increasing order, the thresholds giving the same cutoff sharing their band. There must
+     be at most cMaxCutoffs of them.
+     */
+    static std::vector<uint32_t> getCutoffs(const std::vector<float>& pThresholds)
+    {
+        std::vector<uint32_t> lCutoffs;
+        for (float lThreshold : pThresholds)
+        {
+            lCutoffs.push_back(LightnessImage::getCutoff(lThreshold));
+        }
+        std::sort(lCutoffs.begin(), lCutoffs.end());
+        lCutoffs.erase(std::unique(lCutoffs.begin(), lCutoffs.end()), lCutoffs.end());
+        return lCutoffs;
+    }
+
+    size_t getWidth() const
+    {
+        return mWidth;
+    }
+
+    size_t getHeight() const
+    {
+        return mHeight;
+    }
+
+    /**
+     QImage::cacheKey() of the image the bands were computed from.
+     */
+    qint64 getSourceKey() const
+    {
+        return mSourceKey;
+    }
+
+    size_t getNumBands() const
+    {
+        return mCutoffs.size() + 1;
+    }
+
+    const Band* getRow(size_t y) const
+    {
+        return &mData[y * mWidth];
+    }
+
+    /**
+     Highest band of the pixels whose lightness is lower than pThreshold, which must be one of the thresholds the
+     bands were computed with.
+     */
+    Band getDarkerBand(float pThreshold) const
+    {
+        auto lIt = std::lower_bound(mCutoffs.begin(), mCutoffs.end(), LightnessImage::getCutoff(pThreshold));
+        assert(lIt != mCutoffs.end() && *lIt == LightnessImage::getCutoff(pThreshold));
+        return (Band)(lIt - mCutoffs.begin());
+    }
+
+    /**
+     Pixels whose lightness is lower than pThreshold, pThreshold being one of the thresholds the bands were computed
+     with.
+     */
+    PackedBinaryImage getDarkerMask(float pThreshold) const
+    {
+        typedef PackedBinaryImage::Word Word;
+        const Band cBand = getDarkerBand(pThreshold);
+        PackedBinaryImage lMask(mWidth, mHeight);
+        for (size_t y = 0 ; y != mHeight ; ++y)
+        {
+            const Band* lSrc = getRow(y);
+            Word* lDst = lMask.getRow(y);
+            size_t x = 0;
+#if PP_THRESHOLDBANDS_SSE2
+            // band <= cBand tested as min(band, cBand) == band, 16 pixels at once
+            const __m128i cBands = _mm_set1_epi8((char)cBand);
+            for ( ; x + 16 <= mWidth ; x += 16)
+            {
+                const __m128i lPixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lSrc + x));
+                const __m128i lDarker = _mm_cmpeq_epi8(_mm_min_epu8(lPixels, cBands), lPixels);
+                lDst[x / 64] |= (Word)(uint16_t)_mm_movemask_epi8(lDarker) << (x % 64);
+            }
+#endif
+            for ( ; x != mWidth ; ++x)
+            {
+                lDst[x / 64] |= (Word)(lSrc[x] <= cBand) << (x % 64);
+            }
+        }
+        return lMask;
+    }
+
+private:
+    size_t mWidth;
+    size_t mHeight;
+    qint64 mSourceKey;
+    std::vector<uint32_t> mCutoffs;
+    std::vector<Band> mData;
+};
+
+}
+
+#endif
@@ -9,6 +9,10 @@
 
 #include <QColor>
 
+#include <cctype>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
 #include <string>
 
 namespace PP
@@ -61,6 +65,86 @@ namespace PP
             return mDryTimeSeconds;
         }
 
+        /**
+         Position of the paint well, where the tool is at the end of a refill.
+         */
+        float getRefillStationXMM() const
+        {
+            return mRefillStationXMM;
+        }
+
+        float getRefillStationYMM() const
+        {
+            return mRefillStationYMM;
+        }
+
+        void setRefillStation(float pXMM, float pYMM)
+        {
+            mRefillStationXMM = pXMM;
+            mRefillStationYMM = pYMM;
+        }
+
+        /**
+         Finds in a refill command the position where the tool is dipped, that is the X and Y of the first move down
+         to Z0 or below, or of the last move if there is none. Returns false if no move sets both X and Y.
+         */
+        static bool parseRefillStation(const std::string& pRefillCommand, float& pXMM, float& pYMM)
+        {
+            float lXMM = 0.f;
+            float lYMM = 0.f;
+            bool lHasX = false;
+            bool lHasY = false;
+            std::istringstream lCommand(pRefillCommand);
+            std::string lLine;
+            while (std::getline(lCommand, lLine))
+            {
+                // without the comments
+                std::string lCode;
+                int lDepth = 0;
+                for (char c : lLine.substr(0, lLine.find(';')))
+                {
+                    lDepth += (c == '(') ? 1 : 0;
+                    if (lDepth == 0)
+                    {
+                        lCode += c;
+                    }
+                    lDepth -= (c == ')' && lDepth > 0) ? 1 : 0;
+                }
+                std::istringstream lWords(lCode);
+                std::string lWord;
+                bool lDipped = false;
+                while (lWords >> lWord)
+                {
+                    const char lLetter = std::toupper(lWord[0]);
+                    const float lValue = std::atof(lWord.c_str() + 1);
+                    if (lLetter == 'X')
+                    {
+                        lXMM = lValue;
+                        lHasX = true;
+                    }
+                    else if (lLetter == 'Y')
+                    {
+                        lYMM = lValue;
+                        lHasY = true;
+                    }
+                    else if (lLetter == 'Z' && lValue <= 0.f)
+                    {
+                        lDipped = true;
+                    }
+                }
+                if (lDipped && lHasX && lHasY)
+                {
+                    break;
+                }
+            }
+            if (lHasX && lHasY)
+            {
+                pXMM = lXMM;
+                pYMM = lYMM;
+            }
+            return lHasX && lHasY;
+        }
+
     protected:
         Tool(std::string pName, float pWidthMM, QColor pColour, float pDragErrorMM, bool pNeedsRefill, float pLengthBeforeRefillMM, std::string pRefillCommand, int pDryTimeSeconds)
         : mName(pName)
@@ -71,7 +155,10 @@ namespace PP
         , mLengthBeforeRefillMM(pLengthBeforeRefillMM)
         , mRefillCommand(pRefillCommand)
         , mDryTimeSeconds(pDryTimeSeconds)
+        , mRefillStationXMM(0.f)
+        , mRefillStationYMM(0.f)
         {
+            parseRefillStation(mRefillCommand, mRefillStationXMM, mRefillStationYMM);
         }
 
         std::string mName;
@@ -82,6 +169,8 @@ namespace PP
         float  mLengthBeforeRefillMM;
         std::string mRefillCommand;
         int    mDryTimeSeconds;
+        float  mRefillStationXMM;
+        float  mRefillStationYMM;
     };
 }
 
@@ -7,10 +7,16 @@
  @date      2017-2018
  */
 
-#include "pp_utils.hpp"
+#include "pp_gcodewriter.hpp"
+#include "pp_lightnessimage.hpp"
 
+#include <QImage>
+
+#include <algorithm>
 #include <deque>
 #include <list>
+#include <utility>
+#include <vector>
 
 #include <iostream>
 #include <fstream>
@@ -60,6 +66,9 @@ struct LinePathPixel
 struct CombinedPathsPixels
 {
     std::list<PointPixel> mPoints;
+    CombinedPathsPixels()
+    {
+    }
     CombinedPathsPixels(std::initializer_list<PointPixel> pPoints)
     : mPoints(pPoints)
     {
@@ -179,16 +188,80 @@ struct CombinedPathMM
         
         mPoints = lNewPoints;
     }
-    void compile(std::ofstream& pOut) const
+    /**
+     Removes the points that are closer than pToleranceMM to the path without them (Ramer-Douglas-Peucker): the point
+     of a run farthest from the segment between its ends is kept if it is farther than the tolerance, and both halves
+     are simplified in turn. The ends are always kept, but for a closed path that collapses to a single point.
+     */
+    void simplify(float pToleranceMM)
     {
-        pOut << "G0 Z2.5" << std::endl;
-        pOut << "G0 X" << mPoints.front().mX << " Y" << mPoints.front().mY << std::endl;
-        pOut << "G0 Z0" << std::endl;
+        if (mPoints.size() < 3 || pToleranceMM <= 0.f)
+        {
+            return;
+        }
+        std::vector<bool> lKept(mPoints.size(), false);
+        lKept.front() = true;
+        lKept.back() = true;
+        std::vector<std::pair<size_t, size_t>> lRuns(1, std::make_pair((size_t)0, mPoints.size() - 1));
+        while (!lRuns.empty())
+        {
+            const size_t lFirst = lRuns.back().first;
+            const size_t lLast = lRuns.back().second;
+            lRuns.pop_back();
+            float lFarthestDistance2 = pToleranceMM * pToleranceMM;
+            size_t lFarthest = lFirst;
+            for (size_t u = lFirst + 1 ; u < lLast ; ++u)
+            {
+                const float lDistance2 = getSquaredDistanceToSegment(mPoints[u], mPoints[lFirst], mPoints[lLast]);
+                if (lDistance2 > lFarthestDistance2)
+                {
+                    lFarthestDistance2 = lDistance2;
+                    lFarthest = u;
+                }
+            }
+            if (lFarthest != lFirst)
+            {
+                lKept[lFarthest] = true;
+                lRuns.push_back(std::make_pair(lFirst, lFarthest));
+                lRuns.push_back(std::make_pair(lFarthest, lLast));
+            }
+        }
+        std::deque<PointMM> lNewPoints;
+        for (size_t u = 0 ; u != mPoints.size() ; ++u)
+        {
+            if (lKept[u])
+            {
+                lNewPoints.push_back(mPoints[u]);
+            }
+        }
+        if (lNewPoints.size() == 2 && !(lNewPoints.front() != lNewPoints.back()))
+        {
+            lNewPoints.pop_back();
+        }
+        mPoints.swap(lNewPoints);
+    }
+    static float getSquaredDistanceToSegment(PointMM p, PointMM a, PointMM b)
+    {
+        const float lABX = b.mX - a.mX;
+        const float lABY = b.mY - a.mY;
+        const float lAPX = p.mX - a.mX;
+        const float lAPY = p.mY - a.mY;
+        const float lLength2 = lABX * lABX + lABY * lABY;
+        const float t = (lLength2 > 0.f) ? std::max(0.f, std::min(1.f, (lAPX * lABX + lAPY * lABY) / lLength2)) : 0.f;
+        const float dx = lAPX - t * lABX;
+        const float dy = lAPY - t * lABY;
+        return dx * dx + dy * dy;
+    }
+    void compile(GCodeWriter& pOut) const
+    {
+        pOut.rapidZ(2.5f);
+        pOut.rapid(mPoints.front().mX, mPoints.front().mY);
+        pOut.rapidZ(0.f);
         for (PointMM lPoint : mPoints)
         {
-            pOut << "G1 X" << lPoint.mX << " Y" << lPoint.mY << std::endl;
+            pOut.line(lPoint.mX, lPoint.mY);
         }
-        pOut << "G0 Z2.5" << std::endl;
+        pOut.rapidZ(2.5f);
     }
 };
 
@@ -218,16 +291,43 @@ public:
         }
     }
     
+    BinaryImage& operator =(const BinaryImage& pImage)
+    {
+        if (this != &pImage)
+        {
+            delete []mData;
+            mWidth = pImage.getWidth();
+            mHeight = pImage.getHeight();
+            alloc();
+            for (size_t u = 0 ; u != mWidth * mHeight ; ++u)
+            {
+                mData[u] = pImage.mData[u];
+            }
+        }
+        return *this;
+    }
+    
     BinaryImage(const QImage& pImage, float pThreshold = 0.5f)
-    : mWidth(pImage.width())
-    , mHeight(pImage.height())
+    : BinaryImage(LightnessImage(pImage), pThreshold)
+    {
+    }
+    
+    /**
+     Pixels whose lightness is greater than or equal to pThreshold.
+     */
+    BinaryImage(const LightnessImage& pLightness, float pThreshold)
+    : mWidth(pLightness.getWidth())
+    , mHeight(pLightness.getHeight())
     {
         alloc();
+        const uint32_t cCutoff = LightnessImage::getCutoff(pThreshold);
         for (unsigned int y = 0 ; y != mHeight ; ++y)
         {
+            const LightnessImage::Value* lRow = pLightness.getRow(y);
+            bool* lPixels = mData + y * mWidth;
             for (unsigned int x = 0 ; x != mWidth ; ++x)
             {
-                getPixel(x, y) = (pImage.pixelColor(x, y).lightnessF() >= pThreshold);
+                lPixels[x] = (lRow[x] >= cCutoff);
             }
         }
     }
@@ -326,7 +426,10 @@ private:
 
 namespace MorphOps
 {
-    static void thin(BinaryImage& pImage)
+    /**
+     Reference Zhang-Suen thinning iteration, see pp_thinning.hpp for the optimized MorphOps::thin
+     */
+    inline void thinReference(BinaryImage& pImage)
     {
         // http://agcggs680.pbworks.com/f/Zhan-Suen_algorithm.pdf
         
@@ -453,7 +556,7 @@ namespace MorphOps
         }
     }
     
-    static void erode(BinaryImage& pImage)
+    inline void erode(BinaryImage& pImage)
     {
         // add a border
         BinaryImage lOriginal(pImage.getWidth() + 2, pImage.getHeight() + 2);
@@ -528,7 +631,7 @@ namespace MorphOps
     /**
      Subtract the border of a binary image and return this border
      */
-    static BinaryImage removeBorder(BinaryImage& pImage)
+    inline BinaryImage removeBorder(BinaryImage& pImage)
     {
         BinaryImage lReturn(pImage);
         const int cWidth = (int)lReturn.getWidth();
@@ -648,7 +751,7 @@ namespace MorphOps
     /**
      TODO: misnamed?
      */
-    static void median(BinaryImage& pSrcDst)
+    inline void median(BinaryImage& pSrcDst)
     {
         for (int y = 1 ; y < pSrcDst.getHeight() - 1 ; ++y)
         {
@@ -682,7 +785,7 @@ namespace MorphOps
         }
     }
     
-    static BinaryImage diagonalDown(const BinaryImage& pSrc, int pStepPixels)
+    inline BinaryImage diagonalDown(const BinaryImage& pSrc, int pStepPixels)
     {
         BinaryImage lDst(pSrc.getWidth(), pSrc.getHeight());
         
@@ -715,7 +818,7 @@ namespace MorphOps
         return lDst;
     }
     
-    static BinaryImage diagonalUp(const BinaryImage& pSrc, int pStepPixels)
+    inline BinaryImage diagonalUp(const BinaryImage& pSrc, int pStepPixels)
     {
         BinaryImage lDst(pSrc.getWidth(), pSrc.getHeight());
         
@@ -748,7 +851,7 @@ namespace MorphOps
         return lDst;
     }
 
-    static BinaryImage diagonal(const BinaryImage& pSrc, int pStepPixels, bool pDirection)
+    inline BinaryImage diagonal(const BinaryImage& pSrc, int pStepPixels, bool pDirection)
     {
         if (pDirection)
         {
@@ -763,4 +866,7 @@ namespace MorphOps
 
 }
 
+// MorphOps::thin(BinaryImage&), which needs the definitions above
+#include "pp_thinning.hpp"
+
 #endif